@@ -0,0 +1,99 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Watches a set of asset files for changes, by polling their modification time and size,
+// so the sim can reload them into the running design (+watch_assets). Polling is cheap,
+// portable, and happens at most every interval_ms, however often poll() is called.
+//NOTE: A file that is still being written when it's noticed may fail to load; the caller
+// can retry() it, so it is reported again on the next poll.
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+class ASSET_WATCH {
+public:
+  ASSET_WATCH(int interval_ms = 500) : m_interval(interval_ms) { }
+
+  // Watch a file, reported by poll() as id. Its current state counts as unchanged:
+  void add(int id, const std::string &path) {
+    entry_t e;
+    e.id = id;
+    e.path = path;
+    e.stamp = stamp(path);
+    m_entries.push_back(e);
+  }
+
+  // Stop watching everything:
+  void clear(void) { m_entries.clear(); }
+
+  bool empty(void) const { return m_entries.empty(); }
+
+  // ids of the files that have changed (including being deleted or created) since the last poll:
+  std::vector<int> poll(void) {
+    std::vector<int> changed;
+    auto now = std::chrono::steady_clock::now();
+    if (now - m_last_poll < std::chrono::milliseconds(m_interval)) return changed;
+    m_last_poll = now;
+    for (auto &e : m_entries) {
+      uint64_t s = stamp(e.path);
+      if (s != e.stamp) {
+        e.stamp = s;
+        changed.push_back(e.id);
+      }
+    }
+    return changed;
+  }
+
+  // Report id as changed again on the next poll (e.g. because it couldn't be loaded yet):
+  void retry(int id) {
+    for (auto &e : m_entries) {
+      if (e.id == id) e.stamp = kRetry;
+    }
+  }
+
+private:
+  static const uint64_t kRetry = ~uint64_t(0);
+
+  // Modification time (in ns, where the host has it) and size, folded together. 0 if the file doesn't exist.
+  // Whole seconds alone would miss a rewrite that keeps the same size within a second of the last one:
+  static uint64_t stamp(const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return 0;
+#if defined(__APPLE__)
+    uint64_t ns = st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    uint64_t ns = 0; // Only whole seconds here.
+#else
+    uint64_t ns = st.st_mtim.tv_nsec;
+#endif
+    return (uint64_t(st.st_mtime)*1000000000 + ns) ^ (uint64_t(st.st_size) << 1) ^ 1;
+  }
+
+  typedef struct {
+    int id;
+    std::string path;
+    uint64_t stamp;
+  } entry_t;
+  std::vector<entry_t> m_entries;
+  int m_interval;
+  std::chrono::steady_clock::time_point m_last_poll;
+};
@@ -0,0 +1,60 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <atomic>
+
+// Lock-free triple buffer for handing frames from ONE producer thread (the simulation)
+// to ONE consumer thread (the SDL renderer), without either ever waiting on the other:
+// - The producer fills back(), then publish()es it. It can always do this, and if the
+//   consumer didn't take the previous one yet, that one just gets dropped.
+// - The consumer calls consume(), and if that returns true, front() is now the newest frame.
+//   front() stays valid (and untouched by the producer) until the next successful consume().
+// The 3 slots rotate between these roles; only the "middle" one is shared, and it is
+// handed over with a single atomic exchange. Its FRESH bit says whether it holds a frame
+// that the consumer hasn't seen yet.
+template<class FRAME> class FRAME_EXCHANGE {
+public:
+  FRAME_EXCHANGE(void) : m_back(0), m_middle(1), m_front(2) { }
+
+  // Producer side:
+  FRAME *back(void) { return &m_slots[m_back]; }
+  void publish(void) {
+    m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+  // True if the consumer has taken the last published frame, i.e. publishing now won't drop anything:
+  bool consumed(void) const {
+    return !(m_middle.load(std::memory_order_acquire) & FRESH);
+  }
+
+  // Consumer side:
+  bool consume(void) {
+    if (!(m_middle.load(std::memory_order_relaxed) & FRESH)) return false;
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+  const FRAME *front(void) const { return &m_slots[m_front]; }
+
+private:
+  static const int INDEX = 0b011;
+  static const int FRESH = 0b100;
+  FRAME m_slots[3];
+  int m_back;                   // Only touched by the producer.
+  std::atomic<int> m_middle;    // Shared.
+  int m_front;                  // Only touched by the consumer.
+};
@@ -0,0 +1,104 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Kernels for whole-pixel passes over runs of 32-bit BGRA framebuffer pixels.
+// Because the framebuffer is row-major, a run can be part of a row, or any number of
+// complete rows in one go. SSE2 does 4 pixels at a time, with scalar code for any
+// remainder (and for targets without SSE2).
+//NOTE: Unaligned loads/stores are used throughout, so runs can start anywhere.
+
+// Byte-lane masks for a BGRA pixel held as a little-endian uint32_t:
+#define PIXEL_RGB(v)  (((v)<<16) | ((v)<<8) | (v))  // Same value in each of B, G, and R, but not A.
+
+// p[i] &= mask, for n pixels:
+inline void fb_and(uint32_t *p, size_t n, uint32_t mask) {
+  size_t i = 0;
+#ifdef __SSE2__
+  __m128i m = _mm_set1_epi32(mask);
+  for (; i+4 <= n; i += 4) {
+    __m128i *q = (__m128i*)(p+i);
+    _mm_storeu_si128(q, _mm_and_si128(_mm_loadu_si128(q), m));
+  }
+#endif
+  for (; i < n; ++i) p[i] &= mask;
+}
+
+// p[i] |= mask, for n pixels:
+inline void fb_or(uint32_t *p, size_t n, uint32_t mask) {
+  size_t i = 0;
+#ifdef __SSE2__
+  __m128i m = _mm_set1_epi32(mask);
+  for (; i+4 <= n; i += 4) {
+    __m128i *q = (__m128i*)(p+i);
+    _mm_storeu_si128(q, _mm_or_si128(_mm_loadu_si128(q), m));
+  }
+#endif
+  for (; i < n; ++i) p[i] |= mask;
+}
+
+// p[i] = value, for n pixels:
+inline void fb_fill(uint32_t *p, size_t n, uint32_t value) {
+  size_t i = 0;
+#ifdef __SSE2__
+  __m128i v = _mm_set1_epi32(value);
+  for (; i+4 <= n; i += 4) _mm_storeu_si128((__m128i*)(p+i), v);
+#endif
+  for (; i < n; ++i) p[i] = value;
+}
+
+// Fade the colour bytes (B, G, R) of n pixels to about 95% (exactly: b = b*243/256, rounded down),
+// in integer maths, leaving alpha (the top byte of each pixel) as it was.
+// Returns true if any colour is still non-zero afterwards, i.e. if it's worth fading again.
+#define FADE_NUMERATOR 243
+#define FADE_LANES     0x00FFFFFFu
+inline bool fb_fade(uint32_t *p, size_t n) {
+  size_t i = 0;
+  uint32_t any = 0;
+#ifdef __SSE2__
+  const __m128i zero  = _mm_setzero_si128();
+  const __m128i scale = _mm_set1_epi16(FADE_NUMERATOR);
+  const __m128i lanes = _mm_set1_epi32(FADE_LANES);
+  __m128i acc = zero;
+  for (; i+4 <= n; i += 4) {
+    __m128i *q = (__m128i*)(p+i);
+    __m128i v = _mm_loadu_si128(q);
+    // Widen bytes to 16 bits, multiply, and keep the upper byte of each product:
+    __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), scale), 8);
+    __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), scale), 8);
+    __m128i faded = _mm_and_si128(_mm_packus_epi16(lo, hi), lanes);
+    _mm_storeu_si128(q, _mm_or_si128(faded, _mm_andnot_si128(lanes, v)));
+    acc = _mm_or_si128(acc, faded);
+  }
+  any = _mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF;
+#endif
+  for (; i < n; ++i) {
+    uint32_t v = p[i], r = 0;
+    for (int b = 0; b < 24; b += 8) r |= ((((v>>b) & 0xFF) * FADE_NUMERATOR) >> 8) << b;
+    p[i] = r | (v & ~FADE_LANES);
+    any |= r;
+  }
+  return any != 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+// All printable ASCII glyphs of a font, rasterised ONCE into a single texture, so that
+// drawing text is then just a series of SDL_RenderCopy calls from that texture, rather
+// than TTF rendering + texture creation every time.
+class GLYPH_ATLAS {
+public:
+  static const int kFirst = 32;   // ' '
+  static const int kLast  = 126;  // '~'
+
+  GLYPH_ATLAS(void) : m_texture(NULL), m_height(0) { }
+  ~GLYPH_ATLAS() { destroy(); }
+
+  // Free the texture. This needs to happen while its renderer still exists:
+  void destroy(void) {
+    if (m_texture) SDL_DestroyTexture(m_texture);
+    m_texture = NULL;
+  }
+
+  bool valid(void) const { return m_texture != NULL; }
+  int height(void) const { return m_height; }
+
+  bool build(SDL_Renderer *renderer, TTF_Font *font, SDL_Color color = {255, 255, 255, 255}) {
+    SDL_Surface *glyphs[kLast-kFirst+1];
+    int width = 0;
+    m_height = TTF_FontHeight(font);
+    for (int c = kFirst; c <= kLast; ++c) {
+      int i = c-kFirst;
+      glyphs[i] = TTF_RenderGlyph_Solid(font, c, color);
+      m_advance[i] = 0;
+      TTF_GlyphMetrics(font, c, NULL, NULL, NULL, NULL, &m_advance[i]);
+      m_src[i] = { width, 0, glyphs[i] ? glyphs[i]->w : 0, glyphs[i] ? glyphs[i]->h : 0 };
+      width += m_src[i].w;
+      if (m_src[i].h > m_height) m_height = m_src[i].h;
+    }
+    // Pack them all side-by-side into one transparent surface, then make a texture of that:
+    SDL_Surface *atlas = SDL_CreateRGBSurfaceWithFormat(0, width, m_height, 32, SDL_PIXELFORMAT_ARGB8888);
+    for (int i = 0; i <= kLast-kFirst; ++i) {
+      if (!glyphs[i]) continue;
+      if (atlas) {
+        SDL_Rect dst = m_src[i];
+        SDL_BlitSurface(glyphs[i], NULL, atlas, &dst);
+      }
+      SDL_FreeSurface(glyphs[i]);
+    }
+    if (!atlas) {
+      printf("ERROR: Cannot create glyph atlas surface: %s\n", SDL_GetError());
+      return false;
+    }
+    m_texture = SDL_CreateTextureFromSurface(renderer, atlas);
+    SDL_FreeSurface(atlas);
+    if (!m_texture) {
+      printf("ERROR: Cannot create glyph atlas texture: %s\n", SDL_GetError());
+      return false;
+    }
+    SDL_SetTextureBlendMode(m_texture, SDL_BLENDMODE_BLEND);
+    return true;
+  }
+
+  // Source rect and advance for a character; anything outside the atlas shows as '?':
+  const SDL_Rect &src(char c) const { return m_src[index(c)]; }
+  int advance(char c) const { return m_advance[index(c)]; }
+
+  SDL_Texture *texture(void) const { return m_texture; }
+
+private:
+  static int index(char c) { return (c >= kFirst && c <= kLast) ? c-kFirst : '?'-kFirst; }
+  SDL_Texture *m_texture;
+  SDL_Rect m_src[kLast-kFirst+1];
+  int m_advance[kLast-kFirst+1];
+  int m_height;
+};
+
+
+
+// A piece of text drawn from a GLYPH_ATLAS. Its quads (source and relative destination
+// rects for each character) are only laid out again when the text is set, and callers
+// can use stale() to avoid even formatting the text unless the value it shows has changed.
+class GLYPH_TEXT {
+public:
+  GLYPH_TEXT(void) : m_key(0), m_has_key(false), m_width(0) { }
+
+  // Returns true (and remembers key) if key differs from last time, i.e. set() is needed:
+  bool stale(uint64_t key) {
+    if (m_has_key && key == m_key) return false;
+    m_key = key;
+    m_has_key = true;
+    return true;
+  }
+
+  void set(const GLYPH_ATLAS &atlas, const std::string &text) {
+    m_quads.clear();
+    int x = 0;
+    for (char c : text) {
+      const SDL_Rect &s = atlas.src(c);
+      if (c != ' ') m_quads.push_back({ s, { x, 0, s.w, s.h } });
+      x += atlas.advance(c);
+    }
+    m_width = x;
+  }
+
+  // Draw with the top-left at (x,y), and return the width, so text can be laid out in sequence:
+  int draw(SDL_Renderer *renderer, const GLYPH_ATLAS &atlas, int x, int y) const {
+    for (auto &q : m_quads) {
+      SDL_Rect dst = { q.dst.x+x, q.dst.y+y, q.dst.w, q.dst.h };
+      SDL_RenderCopy(renderer, atlas.texture(), &q.src, &dst);
+    }
+    return m_width;
+  }
+
+private:
+  typedef struct { SDL_Rect src, dst; } quad_t;
+  std::vector<quad_t> m_quads;
+  uint64_t m_key;
+  bool m_has_key;
+  int m_width;
+};
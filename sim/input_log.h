@@ -0,0 +1,210 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Frame-by-frame log of the inputs the sim applies to the design, for recording (+record)
+// and deterministic replay (+replay). It's plain text, so motion paths can also be written
+// or edited by hand (or by a script):
+//
+//  # Anything after a '#' is a comment.
+//  start_pose POSE
+//  start_vectors px py fx fy vx vy  (optional)
+//  FRAME reset show_map moveF moveL moveB moveR pose override px py fx fy vx vy
+//  ...
+//  end FRAMES
+//
+// start_pose (1..10, or 0 for none) is the gTestVectors pose loaded along with the initial
+// reset, as per +pose=N, or start_vectors (raw Q12.12 hex) are, as per +pose=px,py,fx,fy,vx,vy.
+// Frames count from 0 (the first frame after the initial reset). A line only needs to appear
+// when something changes: Each one holds until the next, except for pose. pose (1..10, or 0 for
+// none) loads that gTestVectors pose at the start of that frame only, so every load gets a line
+// of its own. If override is 1, the vectors (raw Q12.12 hex) get written into the design at the
+// start of the frame. "end" gives the total number of frames, so a replay runs for exactly as
+// long as the recording did.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+typedef struct {
+  uint8_t   reset, show_map;
+  uint8_t   moveF, moveL, moveB, moveR;
+  uint8_t   pose;           // 0: None, 1..10: Load that pose (as per F1..F10) at the start of this frame.
+  uint8_t   override;       // 1: vectors get written into the design.
+  uint32_t  vectors[6];     // px, py, fx, fy, vx, vy.
+} input_frame_t;
+
+#define INPUT_LOG_HEADER "# raybox input log v1\n# frame reset show_map moveF moveL moveB moveR pose override px py fx fy vx vy\n"
+
+inline bool same_inputs(const input_frame_t &a, const input_frame_t &b) {
+  return 0 == memcmp(&a, &b, sizeof(a));
+}
+
+
+
+class INPUT_RECORDER {
+public:
+  INPUT_RECORDER(void) : m_file(NULL), m_frames(0), m_has_last(false) { }
+  ~INPUT_RECORDER() { close(); }
+
+  bool open(const char *filename, int start_pose, const uint32_t *start_vectors = NULL) {
+    close();
+    m_file = fopen(filename, "w");
+    if (!m_file) {
+      printf("ERROR: Cannot write input log %s\n", filename);
+      return false;
+    }
+    fputs(INPUT_LOG_HEADER, m_file);
+    fprintf(m_file, "start_pose %d\n", start_pose);
+    if (start_vectors) {
+      fprintf(m_file, "start_vectors %06X %06X %06X %06X %06X %06X\n",
+        start_vectors[0], start_vectors[1], start_vectors[2], start_vectors[3], start_vectors[4], start_vectors[5]);
+    }
+    m_frames = 0;
+    m_has_last = false;
+    return true;
+  }
+
+  bool is_open(void) const { return m_file != NULL; }
+
+  // Log the inputs for the next frame (only actually written if they changed, or load a pose):
+  void frame(input_frame_t in) {
+    if (!m_file) return;
+    if (!in.override) memset(in.vectors, 0, sizeof(in.vectors)); // Keep the log free of irrelevant changes.
+    input_frame_t held = in;
+    held.pose = 0; // A pose load is one-shot (see INPUT_PLAYER::frame()), so it isn't part of what's held.
+    if (in.pose || !m_has_last || !same_inputs(held, m_last)) {
+      fprintf(m_file, "%lu %d %d %d %d %d %d %d %d %06X %06X %06X %06X %06X %06X\n", m_frames,
+        in.reset, in.show_map, in.moveF, in.moveL, in.moveB, in.moveR, in.pose, in.override,
+        in.vectors[0], in.vectors[1], in.vectors[2], in.vectors[3], in.vectors[4], in.vectors[5]);
+      m_last = held;
+      m_has_last = true;
+    }
+    ++m_frames;
+  }
+
+  unsigned long frames(void) const { return m_frames; }
+
+  void close(void) {
+    if (!m_file) return;
+    fprintf(m_file, "end %lu\n", m_frames);
+    fclose(m_file);
+    m_file = NULL;
+  }
+
+private:
+  FILE *m_file;
+  unsigned long m_frames;
+  input_frame_t m_last;
+  bool m_has_last;
+};
+
+
+
+class INPUT_PLAYER {
+public:
+  INPUT_PLAYER(void) : m_loaded(false), m_start_pose(0), m_has_start_vectors(false), m_end(0), m_next(0) { }
+
+  bool load(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+      printf("ERROR: Cannot read input log %s\n", filename);
+      return false;
+    }
+    m_entries.clear();
+    m_start_pose = 0;
+    m_has_start_vectors = false;
+    m_end = 0;
+    bool ok = true;
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), f)) {
+      ++line_number;
+      char *hash = strchr(line, '#');
+      if (hash) *hash = 0;
+      entry_t e = {};
+      unsigned v[14];
+      if (1 == sscanf(line, " end %lu", &m_end)) continue;
+      if (1 == sscanf(line, " start_pose %d", &m_start_pose)) continue;
+      if (6 == sscanf(line, " start_vectors %x %x %x %x %x %x", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5])) {
+        for (int i = 0; i < 6; ++i) m_start_vectors[i] = v[i] & 0xFFFFFF;
+        m_has_start_vectors = true;
+        continue;
+      }
+      int n = sscanf(line, "%lu %u %u %u %u %u %u %u %u %x %x %x %x %x %x", &e.frame,
+        &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10], &v[11], &v[12], &v[13]);
+      if (n <= 0) continue; // Blank line.
+      if (n != 15 || (!m_entries.empty() && e.frame <= m_entries.back().frame)) {
+        printf("ERROR: %s line %d: Bad or out-of-order input log entry\n", filename, line_number);
+        ok = false;
+        break;
+      }
+      e.in.reset    = v[0];   e.in.show_map = v[1];
+      e.in.moveF    = v[2];   e.in.moveL    = v[3];
+      e.in.moveB    = v[4];   e.in.moveR    = v[5];
+      e.in.pose     = v[6];   e.in.override = v[7];
+      for (int i = 0; i < 6; ++i) e.in.vectors[i] = v[8+i] & 0xFFFFFF;
+      m_entries.push_back(e);
+    }
+    fclose(f);
+    if (!ok) return false;
+    // Without an explicit end, just run up to (and including) the last entry:
+    if (m_end == 0 && !m_entries.empty()) m_end = m_entries.back().frame + 1;
+    m_next = 0;
+    m_loaded = true;
+    return true;
+  }
+
+  bool loaded(void) const { return m_loaded; }
+  void unload(void) { m_loaded = false; }
+  unsigned long end(void) const { return m_end; }
+  int start_pose(void) const { return m_start_pose; }
+
+  // Copy out the start_vectors (px, py, fx, fy, vx, vy), if the log has them:
+  bool start_vectors(uint32_t *v) const {
+    if (m_loaded && m_has_start_vectors) memcpy(v, m_start_vectors, sizeof(m_start_vectors));
+    return m_loaded && m_has_start_vectors;
+  }
+
+  // Inputs for the given frame (which must only ever go forwards). pose is only set for the
+  // exact frame that a pose load was logged for. Returns false once the log has ended.
+  bool frame(unsigned long frame, input_frame_t &in) {
+    if (frame >= m_end) return false;
+    while (m_next < m_entries.size() && m_entries[m_next].frame <= frame) {
+      m_current = m_entries[m_next++];
+    }
+    in = m_current.in;
+    if (m_current.frame != frame) in.pose = 0;
+    return true;
+  }
+
+private:
+  typedef struct {
+    unsigned long frame;
+    input_frame_t in;
+  } entry_t;
+  std::vector<entry_t> m_entries;
+  bool m_loaded;
+  int m_start_pose;
+  bool m_has_start_vectors;
+  uint32_t m_start_vectors[6];
+  unsigned long m_end;
+  size_t m_next;
+  entry_t m_current = {};
+};
@@ -15,37 +15,47 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
-class MAIN_TB : public BASE_TB {
+// Everything about running the design in simulation, as a CRTP base (see TESTBENCH) so the per-clock
+// hooks are called statically. MAIN_TB (below) is this as-is. To change any of the hooks (e.g. the
+// sync predicates, or examine()), extend this instead: `class MY_TB : public MAIN_TB_BASE<MY_TB>`.
+template<class DERIVED> class MAIN_TB_BASE : public TESTBENCH<VDESIGN, DERIVED> {
 public:
+  typedef TESTBENCH<VDESIGN, DERIVED> BASE_TB;
+  using BASE_TB::m_core;
+  using BASE_TB::m_tickcount;
+
   bool old_hsync;
   bool old_vsync;
   bool log_vsync;
   bool examine_mode;
   bool examine_condition_met;
+  bool examine_hit;           // Set when examine mode pauses the sim, for the caller to clear.
   bool paused;
   int frame_counter;
+  STIMULUS stimulus; // Coroutines that drive the design's inputs a tick at a time (see stimulus.h).
 
-  MAIN_TB(void) {
+  MAIN_TB_BASE(void) {
     log_vsync = false;
     examine_mode = false;
     examine_condition_met = false;
+    examine_hit = false;
     paused = false;
     frame_counter = 0;
     old_hsync = false;
     old_vsync = false;
   }
 
-  ~MAIN_TB() { }
+  ~MAIN_TB_BASE() { }
 
-  virtual bool hsync_asserted(void) { return 0 == m_core->hsync; }
-  virtual bool vsync_asserted(void) { return 0 == m_core->vsync; }
+  bool hsync_asserted(void) { return 0 == m_core->hsync; }
+  bool vsync_asserted(void) { return 0 == m_core->vsync; }
 
-  virtual bool hsync_started(void) { return 1 == old_hsync &&  hsync_asserted(); }
-  virtual bool vsync_started(void) { return 1 == old_vsync &&  vsync_asserted(); }
-  virtual bool hsync_stopped(void) { return 0 == old_hsync && !hsync_asserted(); }
-  virtual bool vsync_stopped(void) { return 0 == old_vsync && !vsync_asserted(); }
+  bool hsync_started(void) { return 1 == old_hsync &&  self().hsync_asserted(); }
+  bool vsync_started(void) { return 1 == old_vsync &&  self().vsync_asserted(); }
+  bool hsync_stopped(void) { return 0 == old_hsync && !self().hsync_asserted(); }
+  bool vsync_stopped(void) { return 0 == old_vsync && !self().vsync_asserted(); }
 
-  virtual void tick(void) {
+  void tick(void) {
     // if (paused) return;
     //SMELL: We don't respect 'paused' because it's more of a flag for the caller.
     // I've chosen to do it this way because I want the design itself to be able to
@@ -54,34 +64,80 @@ public:
     old_hsync = m_core->hsync;
     old_vsync = m_core->vsync;
     BASE_TB::tick();
-    if (vsync_stopped()) {
-      ++frame_counter;
-      if (log_vsync) {
-        print_time();
-        printf("VSYNC released; starting frame %d.\n", frame_counter);
-      }
-      if (examine()) {
-        pause(true);
-        printf("(Examine condition met)\n");
-        examine_condition_met = false;
-        examine_mode = false; // Disable examine mode. User can turn it back on while we're paused, if they want.
-      }
+    stimulus.tick(m_tickcount, self().vsync_started());
+    if (self().vsync_stopped()) frame_started();
+  }
+
+  // Run n clocks, as per tick(), but via BASE_TB::clock() (i.e. fewer evals per clock). The sync
+  // predicates (which a DERIVED testbench could replace) only get consulted when vsync actually
+  // changes, i.e. twice a frame, rather than on every clock:
+  inline void tick_n(unsigned long n) {
+    while (n--) step();
+  }
+
+  // As per tick_n(), until pred() is true (see BASE_TB::run_until()):
+  template<class PRED> unsigned long run_until(PRED pred, unsigned long max) {
+    unsigned long n = 0;
+    while (n < max && !pred()) {
+      step();
+      ++n;
     }
+    return n;
   }
 
-  virtual bool examine(void) {
+  // How many clocks (up to max) can go straight through BASE_TB::clock() from here, i.e. without
+  // tick_n()'s stimulus and vsync work, before the stimulus next needs to see a tick. The caller has
+  // to know that vsync won't change during them (e.g. none of them ends a line):
+  unsigned long quiet_clocks(unsigned long max) const {
+    uint64_t due = stimulus.next_wake();
+    if (due <= m_tickcount+1) return 0;
+    return due-m_tickcount-1 < max ? due-m_tickcount-1 : max;
+  }
+
+  bool examine(void) {
     if (!examine_mode) return false;
     return examine_condition_met;
   }
 
-  virtual bool pause(bool state) {
+  bool pause(bool state) {
     bool old = paused;
     paused = state;
     if (old != paused) {
-      print_time();
+      self().print_time();
       printf("Simulation will %s\n", paused ? "pause" : "resume");
     }
     return old;
   }
 
+protected:
+  using BASE_TB::self;
+
+private:
+  inline void step(void) {
+    old_hsync = m_core->hsync;
+    old_vsync = m_core->vsync;
+    BASE_TB::clock();
+    bool vsync_changed = old_vsync != m_core->vsync;
+    stimulus.tick(m_tickcount, vsync_changed && self().vsync_started());
+    if (vsync_changed && self().vsync_stopped()) frame_started();
+  }
+
+  // VSYNC has just ended, so a new frame is starting:
+  void frame_started(void) {
+    ++frame_counter;
+    if (log_vsync) {
+      self().print_time();
+      printf("VSYNC released; starting frame %d.\n", frame_counter);
+    }
+    if (self().examine()) {
+      self().pause(true);
+      examine_hit = true;
+      printf("(Examine condition met)\n");
+      examine_condition_met = false;
+      examine_mode = false; // Disable examine mode. User can turn it back on while we're paused, if they want.
+    }
+  }
+
 };
+
+class MAIN_TB : public MAIN_TB_BASE<MAIN_TB> { };
@@ -0,0 +1,232 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Per-phase timing of where the sim's host time goes (+metrics=FILE), so a slow run can be pinned
+// on either the model or the display code. Each phase (refresh, eval, fbwrite, overlay, publish,
+// upload, hud, present) gets a count, total time and a latency histogram, via a SCOPE around it.
+// Every interval, write() adds one record for that interval to the file: CSV, or JSON lines if FILE
+// ends in .json. With console() on, it also prints a one-line FPS/Hz summary to stdout, file or not.
+//
+// Phases can be timed on any thread (e.g. present on the main thread, refresh on the sim thread)
+// while another one writes them out, so everything shared is a relaxed atomic: A record might mix
+// a phase's count from one instant with its time from a moment later, which doesn't matter here.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+class METRICS {
+public:
+  enum {
+    REFRESH,  // simulate_refresh(): All of it, i.e. model eval, framebuffer writes, and per-frame work.
+    EVAL,     // Model eval for a run of pixels (capture_span()), i.e. just clocking the design...
+    FBWRITE,  // ...and then packing that line's output into the framebuffer.
+    OVERLAY,  // Guides/overlay passes over the framebuffer, and clearing its "freshness" highlight.
+    PUBLISH,  // Copying the framebuffer (and HUD state) for the main thread.
+    UPLOAD,   // SDL texture upload (and copy to the renderer).
+    HUD,      // render_hud().
+    PRESENT,  // SDL_RenderPresent().
+    PHASES
+  };
+  static const int kBuckets = 40; // Bucket b holds durations in [2^b, 2^(b+1)) ns.
+
+  METRICS(void) : m_file(NULL), m_json(false), m_interval_ms(1000), m_console(false), m_target_hz(0) { reset(); }
+  ~METRICS() { close(); }
+
+  static const char *phase_name(int phase) {
+    static const char *names[PHASES] = { "refresh", "eval", "fbwrite", "overlay", "publish", "upload", "hud", "present" };
+    return names[phase];
+  }
+
+  bool open(const char *filename, int interval_ms) {
+    close();
+    m_file = fopen(filename, "w");
+    if (!m_file) {
+      printf("ERROR: Cannot write metrics to %s\n", filename);
+      return false;
+    }
+    size_t len = strlen(filename);
+    m_json = len > 5 && 0 == strcmp(filename + len - 5, ".json");
+    m_interval_ms = interval_ms > 0 ? interval_ms : 1000;
+    if (!m_json) {
+      fprintf(m_file, "time,ticks,frames,hz,fps");
+      for (int p = 0; p < PHASES; ++p) {
+        const char *n = phase_name(p);
+        fprintf(m_file, ",%s_count,%s_ms,%s_mean_us,%s_p50_us,%s_p99_us,%s_max_us", n, n, n, n, n, n);
+      }
+      fprintf(m_file, "\n");
+    }
+    reset();
+    return true;
+  }
+
+  bool is_open(void) const { return m_file != NULL; }
+
+  // Also print each interval's FPS and Hz (against target_hz) to stdout, as the windowed sim does:
+  void console(bool on, uint64_t target_hz) {
+    if (on && !m_console) m_start = std::chrono::steady_clock::now(); // For the total average FPS.
+    m_console = on;
+    m_target_hz = target_hz;
+  }
+
+  // Measure the next interval from here, e.g. when ticks/frames have jumped (restoring a checkpoint):
+  void rebase(uint64_t ticks, uint64_t frames) {
+    m_last_write = std::chrono::steady_clock::now();
+    m_last_ticks = ticks;
+    m_last_frames = frames;
+  }
+
+  void record(int phase, uint64_t ns) {
+    phase_t &p = m_phases[phase];
+    p.ns.fetch_add(ns, std::memory_order_relaxed);
+    p.buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t max = p.max_ns.load(std::memory_order_relaxed);
+    while (ns > max && !p.max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) { }
+  }
+
+  // Times a phase for as long as it's in scope (and costs nothing if metrics aren't on):
+  class SCOPE {
+  public:
+    SCOPE(METRICS &m, int phase) : m_metrics(m.is_open() ? &m : NULL), m_phase(phase) {
+      if (m_metrics) m_start = std::chrono::steady_clock::now();
+    }
+    ~SCOPE() {
+      if (m_metrics) m_metrics->record(m_phase, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+    }
+  private:
+    METRICS *m_metrics;
+    int m_phase;
+    std::chrono::steady_clock::time_point m_start;
+  };
+
+  // Write a record if the interval is up (or force), given the sim's total ticks and frames so far:
+  void write(uint64_t ticks, uint64_t frames, bool force = false) {
+    if (!m_file && !m_console) return;
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - m_last_write).count();
+    if (!force && elapsed*1000.0 < m_interval_ms) return;
+    if (elapsed <= 0) return;
+    double time = std::chrono::duration<double>(now - m_start).count();
+    double hz = (ticks - m_last_ticks) / elapsed;
+    double fps = (frames - m_last_frames) / elapsed;
+    if (m_console) {
+      printf("Current FPS: %5.2f - Total average FPS: %5.2f - m_tickcount=%llu (%.0f Hz; %3.0f%% of target)\n",
+        fps, time > 0 ? frames / time : 0, (unsigned long long)ticks, hz, m_target_hz ? 100.0*hz/m_target_hz : 0);
+    }
+    m_last_write = now;
+    m_last_ticks = ticks;
+    m_last_frames = frames;
+    if (!m_file) return;
+    if (m_json) {
+      fprintf(m_file, "{\"time\":%.3f,\"ticks\":%llu,\"frames\":%llu,\"hz\":%.0f,\"fps\":%.2f,\"phases\":{",
+        time, (unsigned long long)ticks, (unsigned long long)frames, hz, fps);
+    } else {
+      fprintf(m_file, "%.3f,%llu,%llu,%.0f,%.2f", time, (unsigned long long)ticks, (unsigned long long)frames, hz, fps);
+    }
+    for (int p = 0; p < PHASES; ++p) {
+      interval_t i = take_interval(p);
+      if (m_json) {
+        fprintf(m_file, "%s\"%s\":{\"count\":%llu,\"ms\":%.3f,\"mean_us\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}",
+          p ? "," : "", phase_name(p), (unsigned long long)i.count, i.ms, i.mean_us, i.p50_us, i.p99_us, i.max_us);
+      } else {
+        fprintf(m_file, ",%llu,%.3f,%.1f,%.1f,%.1f,%.1f", (unsigned long long)i.count, i.ms, i.mean_us, i.p50_us, i.p99_us, i.max_us);
+      }
+    }
+    fprintf(m_file, m_json ? "}}\n" : "\n");
+    fflush(m_file);
+  }
+
+  void close(void) {
+    if (!m_file) return;
+    fclose(m_file);
+    m_file = NULL;
+  }
+
+private:
+  //NOTE: No count of its own: That's the sum of the buckets, which take_interval() adds up anyway.
+  typedef struct {
+    std::atomic<uint64_t> ns;
+    std::atomic<uint64_t> max_ns;
+    std::atomic<uint64_t> buckets[kBuckets];
+  } phase_t;
+
+  typedef struct {
+    uint64_t count;
+    double ms, mean_us, p50_us, p99_us, max_us;
+  } interval_t;
+
+  static int bucket(uint64_t ns) {
+    int b = 0;
+    while (ns > 1 && b < kBuckets-1) { ns >>= 1; ++b; }
+    return b;
+  }
+
+  // Everything recorded for a phase since the last interval (resetting it for the next one).
+  // Percentiles are the upper end of the histogram bucket they fall in (but no more than the max):
+  interval_t take_interval(int phase) {
+    phase_t &p = m_phases[phase];
+    uint64_t buckets[kBuckets];
+    uint64_t count = 0;
+    for (int b = 0; b < kBuckets; ++b) count += (buckets[b] = p.buckets[b].exchange(0, std::memory_order_relaxed));
+    uint64_t ns = p.ns.exchange(0, std::memory_order_relaxed);
+    uint64_t max_ns = p.max_ns.exchange(0, std::memory_order_relaxed);
+    interval_t i = {};
+    i.count = count;
+    i.ms = ns / 1e6;
+    i.max_us = max_ns / 1e3;
+    if (count) {
+      i.mean_us = ns / 1e3 / count;
+      i.p50_us = std::min(percentile(buckets, count, 0.50), i.max_us);
+      i.p99_us = std::min(percentile(buckets, count, 0.99), i.max_us);
+    }
+    return i;
+  }
+
+  static double percentile(const uint64_t *buckets, uint64_t count, double q) {
+    uint64_t want = uint64_t(q * count + 0.5), seen = 0;
+    if (want < 1) want = 1;
+    for (int b = 0; b < kBuckets; ++b) {
+      seen += buckets[b];
+      if (seen >= want) return double(uint64_t(2) << b) / 1e3;
+    }
+    return 0;
+  }
+
+  void reset(void) {
+    for (auto &p : m_phases) {
+      p.ns = 0;
+      p.max_ns = 0;
+      for (auto &b : p.buckets) b = 0;
+    }
+    m_start = m_last_write = std::chrono::steady_clock::now();
+    m_last_ticks = m_last_frames = 0;
+  }
+
+  FILE *m_file;
+  bool m_json;
+  int m_interval_ms;
+  bool m_console;
+  uint64_t m_target_hz;
+  phase_t m_phases[PHASES];
+  std::chrono::steady_clock::time_point m_start, m_last_write;
+  uint64_t m_last_ticks, m_last_frames;
+};
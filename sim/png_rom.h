@@ -0,0 +1,97 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Conversion of a PNG into the contents of one of the design's ROMs, shared by utils/asset_tool
+// (which writes it out as a .hex file for $readmemh) and the sim (which loads PNGs straight into
+// its ROMs). The ROM holds the image by columns, then rows (i.e. byte x*height+y is pixel x,y),
+// each byte being either:
+//  - xrgb222 (0b00rrggbb), i.e. the upper 2 bits of each channel, for textures and sprites; or
+//  - a 2-bit map cell, for maps, which may only use black (0), blue (1), red (2) and white (3).
+//NOTE: The PNG must be 24-bit RGB (no alpha channel), and exactly width x height pixels.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+// Pack an RGB pixel into 0b00rrggbb:
+inline uint8_t xrgb222(const uint8_t *rgb) {
+  return (rgb[0]&0xC0)>>2 | (rgb[1]&0xC0)>>4 | (rgb[2]&0xC0)>>6;
+}
+
+// Load a width x height PNG as ROM bytes, into data:
+inline bool load_png_rom(const char *filename, int width, int height, bool is_map, std::vector<uint8_t> &data) {
+  SDL_Surface* s = IMG_Load(filename);
+  if (!s) {
+    printf("ERROR: Failed to load texture image file '%s' due to error '%s'\n", filename, SDL_GetError());
+    return false;
+  }
+  if (s->w != width || s->h != height) {
+    printf("ERROR: Image '%s' should be %dx%d pixels, but is: %dx%d\n", filename, width, height, s->w, s->h);
+    SDL_FreeSurface(s);
+    return false;
+  }
+  Uint32 fmt = s->format->format;
+  if (fmt != SDL_PIXELFORMAT_RGB24) { //NOTE: 24-bit, not 32-bit (i.e. no alpha channel).
+    printf("ERROR: Image '%s' is wrong pixel format. Was expecting %x but got %x\n", filename, SDL_PIXELFORMAT_RGB24, fmt);
+    SDL_FreeSurface(s);
+    return false;
+  }
+  SDL_LockSurface(s);
+  data.resize(width*height);
+  bool ok = true;
+  int i = 0;
+  for (int x = 0; x < width && ok; ++x) {
+    for (int y = 0; y < height; ++y) {
+      uint8_t c = xrgb222((const uint8_t*)s->pixels + y*s->pitch + x*3);
+      if (is_map) {
+        switch (c) {
+          case 0b00000000:  c = 0b00; break;
+          case 0b00000011:  c = 0b01; break;
+          case 0b00110000:  c = 0b10; break;
+          case 0b00111111:  c = 0b11; break;
+          default:
+            printf("ERROR: Map '%s' uses invalid colour: %02X\n", filename, c);
+            ok = false;
+        }
+        if (!ok) break;
+      }
+      data[i++] = c;
+    }
+  }
+  SDL_UnlockSurface(s);
+  SDL_FreeSurface(s);
+  return ok;
+}
+
+// The text of a hex ROM file (for $readmemh) holding data, 16 bytes per line, in out:
+inline void rom_to_hex(const std::vector<uint8_t> &data, std::string &out) {
+  static const char hex[] = "0123456789ABCDEF";
+  out.clear();
+  out.reserve(data.size()*3);
+  for (size_t i = 0; i < data.size(); ++i) {
+    out += hex[data[i] >> 4];
+    out += hex[data[i] & 15];
+    out += (i & 15) == 15 ? '\n' : ' ';
+  }
+}
@@ -18,3 +18,7 @@
 `define TEXTURE2_FILE   "assets/red-wall-xrgb2222.hex"
 `define TEXTURE3_FILE   "assets/grey-wall-xrgb2222.hex"
 `define MAP_FILE        "assets/map_16x16.hex"
+
+// The sim can load all of the above from a binary ROM image instead (see sim/rom_image.h),
+// in which case ROMs skip their $readmemh when +rom_image is given:
+`define ROM_IMAGE_PLUSARG
@@ -0,0 +1,239 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Packed binary image of all the design's ROMs (wall textures, sprite, map), as written by
+// `utils/asset_tool rom` and loaded by the sim's +rom_image option. The sim maps the file and
+// copies each section straight into the matching verilator-public ROM array, instead of
+// having $readmemh parse ~70kB of hex text every time it starts.
+//
+// A ROM image is a rom_image_header_t, then `sections` rom_section_t entries, then the data.
+// Each section is the raw bytes of one ROM, in exactly the order $readmemh fills it from the
+// equivalent hex file(s) (i.e. the hex files' addresses are byte offsets into the section):
+//  texture:  3 x 8192 bytes (TEXTURE1_FILE, TEXTURE2_FILE, TEXTURE3_FILE)
+//  sprite:   4096 bytes (SPRITE_FILE)
+//  map:      4096 bytes (MAP_FILE, for a 64x64 map_rom)
+//NOTE: All fields are little-endian (i.e. written as-is on x86 and ARM hosts).
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+  // No mmap; the image just gets read into memory instead.
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#define ROM_IMAGE_MAGIC       "RBROMIMG"
+#define ROM_IMAGE_VERSION     1
+#define ROM_IMAGE_ALIGN       64    // Each section's data starts on a multiple of this.
+
+#define ROM_TEXTURES          3
+#define ROM_TEXTURE_SIZE      8192  // 64x64, 2 sides.
+#define ROM_SPRITE_SIZE       4096  // 64x64.
+#define ROM_MAP_SIZE          4096  // 64x64.
+
+typedef struct {
+  char      magic[8];       // ROM_IMAGE_MAGIC
+  uint32_t  version;        // ROM_IMAGE_VERSION
+  uint32_t  sections;       // Number of rom_section_t that follow.
+} rom_image_header_t;
+
+typedef struct {
+  char      name[8];        // e.g. "texture", NUL-padded.
+  uint32_t  offset;         // From the start of the file.
+  uint32_t  size;           // Bytes.
+} rom_section_t;
+
+// Load a hex ROM file into data (size bytes) the way $readmemh would: Whitespace-separated
+// hex values, '@' setting the address, '//' comments. Anything it doesn't cover stays 0.
+inline bool read_hex_rom(const char *filename, uint8_t *data, size_t size) {
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    printf("ERROR: Cannot open hex ROM file %s\n", filename);
+    return false;
+  }
+  memset(data, 0, size);
+  size_t addr = 0;
+  char token[64];
+  while (fscanf(f, "%63s", token) == 1) {
+    if (token[0] == '/' && token[1] == '/') {
+      int c;
+      while ((c = fgetc(f)) != EOF && c != '\n') { }
+    }
+    else if (token[0] == '@') {
+      addr = strtoul(token+1, NULL, 16);
+    }
+    else if (isxdigit(token[0])) {
+      if (addr < size) data[addr] = strtoul(token, NULL, 16);
+      ++addr;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+
+
+// Builds the bytes of a ROM image from named sections:
+class ROM_IMAGE_BUILDER {
+public:
+  void add(const char *name, const std::vector<uint8_t> &data) { m_sections.push_back({ name, data }); }
+
+  std::string build(void) const {
+    rom_image_header_t header = {};
+    memcpy(header.magic, ROM_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = ROM_IMAGE_VERSION;
+    header.sections = m_sections.size();
+    std::vector<rom_section_t> table(m_sections.size());
+    size_t offset = align(sizeof(header) + table.size()*sizeof(rom_section_t));
+    for (size_t i = 0; i < m_sections.size(); ++i) {
+      memset(&table[i], 0, sizeof(table[i]));
+      strncpy(table[i].name, m_sections[i].name.c_str(), sizeof(table[i].name));
+      table[i].offset = offset;
+      table[i].size = m_sections[i].data.size();
+      offset = align(offset + table[i].size);
+    }
+    std::string out(offset, '\0');
+    memcpy(&out[0], &header, sizeof(header));
+    if (!table.empty()) memcpy(&out[sizeof(header)], table.data(), table.size()*sizeof(rom_section_t));
+    for (size_t i = 0; i < m_sections.size(); ++i) {
+      if (table[i].size) memcpy(&out[table[i].offset], m_sections[i].data.data(), table[i].size);
+    }
+    return out;
+  }
+
+private:
+  static size_t align(size_t n) { return (n + ROM_IMAGE_ALIGN-1) & ~size_t(ROM_IMAGE_ALIGN-1); }
+
+  struct section_t {
+    std::string name;
+    std::vector<uint8_t> data;
+  };
+  std::vector<section_t> m_sections;
+};
+
+
+
+// Read-only view of a ROM image file (memory-mapped where possible):
+class ROM_IMAGE {
+public:
+  ROM_IMAGE(void) : m_data(NULL), m_size(0), m_mapped(false) { }
+  ~ROM_IMAGE() { close(); }
+
+  bool open(const char *filename) {
+    close();
+#ifdef _WIN32
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+      printf("ERROR: Cannot open ROM image %s\n", filename);
+      return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    m_buffer.resize(size > 0 ? size : 0);
+    bool ok = size > 0 && fread(m_buffer.data(), 1, size, f) == (size_t)size;
+    fclose(f);
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+#else
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+      printf("ERROR: Cannot open ROM image %s\n", filename);
+      return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && st.st_size > 0;
+    if (ok) {
+      void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ok = p != MAP_FAILED;
+      if (ok) {
+        m_data = (const uint8_t *)p;
+        m_size = st.st_size;
+        m_mapped = true;
+      }
+    }
+    ::close(fd); // The mapping stays valid without it.
+#endif
+    if (!ok || !valid()) {
+      printf("ERROR: %s is not a valid ROM image (version %d)\n", filename, ROM_IMAGE_VERSION);
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  bool is_open(void) const { return m_data != NULL; }
+
+  // Data for the named section, or NULL if there's no such section of exactly the given size:
+  const uint8_t *section(const char *name, size_t size) const {
+    if (!is_open()) return NULL;
+    const rom_image_header_t *header = (const rom_image_header_t *)m_data;
+    const rom_section_t *table = (const rom_section_t *)(m_data + sizeof(rom_image_header_t));
+    for (uint32_t i = 0; i < header->sections; ++i) {
+      if (0 == strncmp(table[i].name, name, sizeof(table[i].name))) {
+        if (table[i].size != size) {
+          printf("ERROR: ROM image section '%s' is %u bytes, but expected %zu\n", name, table[i].size, size);
+          return NULL;
+        }
+        return m_data + table[i].offset;
+      }
+    }
+    printf("ERROR: ROM image has no '%s' section\n", name);
+    return NULL;
+  }
+
+  void close(void) {
+#ifndef _WIN32
+    if (m_mapped) munmap((void *)m_data, m_size);
+#endif
+    m_buffer.clear();
+    m_data = NULL;
+    m_size = 0;
+    m_mapped = false;
+  }
+
+private:
+  // Header, section table, and every section's data must all lie within the file:
+  bool valid(void) const {
+    if (m_size < sizeof(rom_image_header_t)) return false;
+    const rom_image_header_t *header = (const rom_image_header_t *)m_data;
+    if (memcmp(header->magic, ROM_IMAGE_MAGIC, sizeof(header->magic)) || header->version != ROM_IMAGE_VERSION) return false;
+    size_t table_end = sizeof(rom_image_header_t) + size_t(header->sections)*sizeof(rom_section_t);
+    if (table_end > m_size) return false;
+    const rom_section_t *table = (const rom_section_t *)(m_data + sizeof(rom_image_header_t));
+    for (uint32_t i = 0; i < header->sections; ++i) {
+      if (size_t(table[i].offset) + table[i].size > m_size) return false;
+    }
+    return true;
+  }
+
+  const uint8_t *m_data;
+  size_t m_size;
+  bool m_mapped;
+  std::vector<uint8_t> m_buffer; // Only used where the file can't be mapped.
+};
@@ -0,0 +1,67 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Helpers shared by the Verilator drivers (sim/sim_main.cpp and sim/tracer_bench.cpp):
+// plusargs, and loading a map straight into a design's map_rom.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "verilated.h"
+#include "rom_image.h"
+
+// Check whether a plusarg like "+name" or "+name=value" was given on the command-line:
+inline bool has_plusarg(const char* name) {
+  return Verilated::commandArgsPlusMatch(name)[0] != 0;
+}
+
+// Get the value of a "+name=value" plusarg, if it was given.
+//NOTE: commandArgsPlusMatch returns a shared buffer, so we copy the value out of it.
+inline bool get_plusarg(const char* name, std::string &value) {
+  std::string prefix = std::string(name) + "=";
+  const char* match = Verilated::commandArgsPlusMatch(prefix.c_str());
+  if (!match[0]) return false;
+  value = match + 1 + prefix.length(); // Skip over the leading '+' and the "name=".
+  return true;
+}
+
+inline int get_plusarg_int(const char* name, int default_value) {
+  std::string value;
+  if (!get_plusarg(name, value)) return default_value;
+  return atoi(value.c_str());
+}
+
+// Copy ROM_MAP_SIZE bytes of map data (by columns, then rows) into a design's map_rom.
+//NOTE: Assumes a 64x64 map_rom, i.e. MAP_SIZE_BITS=6 in raybox.v (and as per tracer_top.v).
+template<class MAP_ROM_T> void fill_design_map(MAP_ROM_T *map, const uint8_t *data) {
+  for (int col = 0; col < 64; ++col) {
+    for (int row = 0; row < 64; ++row) map->dummy_memory[col][row] = data[col*64 + row] & 3; // map_rom.v outputs only BITS=2.
+  }
+}
+
+// Load a $readmemh-style hex map file into a design's map_rom:
+template<class MAP_ROM_T> bool load_design_map(MAP_ROM_T *map, const char *filename) {
+  std::vector<uint8_t> data(ROM_MAP_SIZE);
+  if (!read_hex_rom(filename, data.data(), data.size())) return false;
+  fill_design_map(map, data.data());
+  printf("Loaded map from %s\n", filename);
+  return true;
+}
@@ -19,16 +19,28 @@
 // #include <err.h>
 #include <iostream>
 #include <string>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
 #include <filesystem> // For std::filesystem::absolute() (which is only used if we have C++17)
+#ifndef _WIN32
+  #include <sys/resource.h> // For getrusage(), to report peak RSS.
+#endif
 #include "testbench.h"
 using namespace std;
 
 #include "Vraybox.h"
+#ifdef SAVABLE
+  #include "verilated_save.h"   // The Makefile builds the main sim with --savable, for checkpoints.
+#endif
 
 #define DESIGN      raybox
 #define VDESIGN     Vraybox
 #define MAIN_TB     Vraybox_TB
-#define BASE_TB     TESTBENCH<VDESIGN>
 
 #define HILITE      0b0001'1111
 
@@ -41,11 +53,11 @@ using namespace std;
 #define Qn  12
 
 // #define USE_POWER_PINS //NOTE: This is automatically set in the Makefile, now.
-#define INSPECT_INTERNAL //NOTE: This is automatically set in the Makefile, now.
-#ifdef INSPECT_INTERNAL
-  #include "Vraybox_raybox.h"       // Needed for accessing "verilator public" stuff in `raybox`
-  #include "Vraybox_texture_rom.h"  // Needed for accessing "verilator public" stuff in `raybox.wall_textures`
-#endif
+#define INSPECT_INTERNAL // Shows the design's internal state (vectors etc) in the HUD.
+//NOTE: These are needed whether or not INSPECT_INTERNAL is on, because the sim pokes at the design's
+// vectors and ROMs directly:
+#include "Vraybox_raybox.h"       // Needed for accessing "verilator public" stuff in `raybox`
+#include "Vraybox_texture_rom.h"  // Needed for accessing "verilator public" stuff in `raybox.wall_textures`
 
 #define FONT_FILE "sim/font-cousine/Cousine-Regular.ttf"
 
@@ -98,7 +110,24 @@ using namespace std;
 #define FRAMEBUFFER_SIZE WINDOW_WIDTH*WINDOW_HEIGHT*4
 
 // The MAIN_TB class that includes specifics about running our design in simulation:
+#include "stimulus.h"
 #include "main_tb.h"
+#include "frame_exchange.h"
+#include "framebuffer_ops.h"
+#include "glyph_atlas.h"
+#include "tracer_model.h"
+#include "trace_capture.h"
+#include "tracer_profiler.h"
+#include "input_log.h"
+#include "test_vectors.h"
+#include "spi_master.h"
+#include "rom_image.h"
+#include "sim_common.h"
+#include "png_rom.h"
+#include "asset_watch.h"
+#include "wave_window.h"
+#include "metrics.h"
+#include "video_writer.h"
 
 
 //SMELL: This doesn't do anything besides keeping certain linkers happy.
@@ -122,101 +151,13 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 #endif // WINDOWS
 
 
-uint32_t gTestVectors[10][6] {
-  //NOTE: These are based on Q12.12...
-  { // F1: Shows 0 line on X:
-    0x00001800, // 1.500000
-    0x0000D800, // 13.500000
-    0x0000011E, // 0.069824
-    0x00FFF00B, // -0.997314
-    0x000007FA, // 0.498535
-    0x0000008F, // 0.034912
-  },
-  { // F2: Shows oversized column:
-    0x00001800, // 1.500000
-    0x0000D800, // 13.500000
-    0x00000198, // 0.099609
-    0x00FFF015, // -0.994873
-    0x000007F5, // 0.497314
-    0x000000CC, // 0.049805
-  },
-  { // F3: Shows undersized column:
-    0x00002172, // 2.090332
-    0x0000D681, // 13.406494
-    0x0000052F, // 0.323975
-    0x00FFF0DE, // -0.945801
-    0x00000791, // 0.472900
-    0x00000297, // 0.161865
-  },
-  { // F4: Another undersized column:
-    0x0000249A, // 2.287598
-    0x0000C860, // 12.523438
-    0x00000E9A, // 0.912598
-    0x00FFF977, // -0.408447
-    0x00000344, // 0.204102
-    0x0000074D, // 0.456299
-  },
-  { // F5: 0 line on Y:
-    0x0000250D, // 2.315674
-    0x0000BB16, // 11.692871
-    0x00000FF5, // 0.997314
-    0x00FFFEDF, // -0.070557
-    0x00000090, // 0.035156
-    0x000007FA, // 0.498535
-  },
-  { // F6: Testing a little "jitter" on a wall block edge:
-    0x000044C4, // 4.297852
-    0x0000BC33, // 11.762451
-    0x00000F7F, // 0.968506
-    0x00FFFC09, // -0.247803
-    0x000001FB, // 0.123779
-    0x000007BF, // 0.484131
-  },
-  { // F7: HACK: 0.53125 vplane:
-    0x00001800, // 1.500000
-    0x0000D800, // 13.500000
-    0x00000000, // 0.000000
-    0x00FFF000, // -1.000000
-    0x00000880, // 0.531250
-    0x00000000, // 0.000000
-  },
-  { // F8: HACK: 0.5625 vplane:
-    0x00001800, // 1.500000
-    0x0000D800, // 13.500000
-    0x00000000, // 0.000000
-    0x00FFF000, // -1.000000
-    0x00000900, // 0.562500
-    0x00000000, // 0.000000
-  },
-  { // F9: HACK: 0.625 vplane:
-    0x00001800, // 1.500000
-    0x0000D800, // 13.500000
-    0x00000000, // 0.000000
-    0x00FFF000, // -1.000000
-    0x00000A00, // 0.625000
-    0x00000000, // 0.000000
-  },
-  { // F10: HACK: 0.75 vplane:
-    0x00001800, // 1.500000
-    0x0000D800, // 13.500000
-    0x00000000, // 0.000000
-    0x00FFF000, // -1.000000
-    0x00000C00, // 0.750000
-    0x00000000, // 0.000000
-  },
-};
-
-
 // Testbench for main design:
 MAIN_TB       *TB;
-bool          gQuit = false;
+atomic<bool>  gQuit(false); // Shared by the main (SDL) thread and the simulation thread.
 int           gRefreshLimit = REFRESH_FRAME;
-int           gOriginalTime;
-int           gPrevTime;
-int           gPrevFrames;
-unsigned long gPrevTickCount;
 bool          gSyncLine = false;
 bool          gSyncFrame = false;
+bool          gHeadless = false; // If true, run without any SDL window/renderer/font. See run_headless().
 bool          gHighlight = true;
 bool          gGuides = false;
 bool          gOverrideVectors = false;
@@ -251,33 +192,91 @@ enum {
 bool gLockInputs[LOCK__MAX] = {0};
 
 
-// From: https://stackoverflow.com/a/38169008
-// - x, y: upper left corner.
-// - texture, rect: outputs.
-void get_text_and_rect(
-  SDL_Renderer *renderer,
-  int x,
-  int y,
-  const char *text,
-  TTF_Font *font,
-  SDL_Texture **texture,
-  SDL_Rect *rect
-) {
-  int text_width;
-  int text_height;
-  SDL_Surface *surface;
-  SDL_Color textColor = {255, 255, 255, 0};
-
-  surface = TTF_RenderText_Solid(font, text, textColor);
-  *texture = SDL_CreateTextureFromSurface(renderer, surface);
-  text_width = surface->w;
-  text_height = surface->h;
-  SDL_FreeSurface(surface);
-  rect->x = x;
-  rect->y = y;
-  rect->w = text_width;
-  rect->h = text_height;
-}
+// Trace checking and capture both look at trace_buffer at the end of each frame (i.e. once the
+// tracer has had its VBLANK), and need the vectors that the tracer was working from:
+bool            gVblankArmed = false;       // True once gVblankVectors holds the vectors for the current VBLANK.
+fixed_vectors_t gVblankVectors;             // The design's vectors going into VBLANK.
+unsigned long   gVblankStart;               // TB->m_tickcount when that VBLANK started.
+
+// Trace checking: When on, compares each column of trace_buffer against TRACER_MODEL, given the same vectors and map.
+bool            gCheckTraces = false;
+int             gCheckedFrames = 0;
+int             gMismatchedFrames = 0;
+bool            gLastCheckFailed = false;   // Only the first of a run of failing frames gets a full report.
+
+// Trace capture (+capture=FILE): When open, every frame's traces get appended to it.
+TRACE_CAPTURE_WRITER gCapture;
+
+// Tracer profiling (+profile=PREFIX): When open, samples the tracer FSM on every VBLANK clock.
+TRACER_PROFILER gProfiler;
+
+// Input recording (+record=FILE) and replay (+replay=FILE). Both start from a reset, and then
+// lock refreshes to whole frames, so that the inputs for each frame are applied at its start:
+INPUT_RECORDER  gRecorder;
+INPUT_PLAYER    gPlayer;
+unsigned long   gInputFrame = 0;      // Frames replayed so far.
+int             gPendingPose = 0;     // Pose an F-key loaded since the last frame's inputs were recorded.
+
+// Vectors go into the design the way they would from a real MCU: Over SPI, shifted out by gSpi
+// over the ticks that follow (see sim/spi_master.h). +spi_backdoor pokes them straight into
+// ready_buffer instead (which is how the sim did it before it had an SPI master):
+SPI_MASTER<VDESIGN> *gSpi;
+bool            gSpiBackdoor = false;
+bool            gPokeInFlight = false;      // poke_vectors() is waiting to see gPokedVectors reach ready_buffer.
+uint32_t        gPokedVectors[6];
+#define V_LOAD_LINE (VDA-2)                 // raybox.v's spi_load_ready: ready_buffer loads on this line's last clock.
+
+// Checkpoints (SAVABLE builds only): The whole design, plus the harness state that goes with it,
+// saved to gCheckpointFile (+checkpoint=FILE) with K, and restored with Shift+K or +restore=FILE.
+string          gCheckpointFile = "raybox.ckpt";
+string          gRestoreFile;               // Checkpoint to start from, instead of cold (or from a reset).
+bool            gSaveCheckpoint = false;    // Requested, but waiting for stimulus (e.g. SPI) to finish.
+bool            gRestoreCheckpoint = false;
+
+#ifdef TRACE
+// Triggered waveform capture (TRACE builds only, e.g. make sim_fst): +wave=PREFIX arms it from the start,
+// Shift+T arms/disarms, and T, examine mode pausing the sim, or reaching +wave_frame=N triggers it.
+WAVE_WINDOW<MAIN_TB> gWaves;
+int             gWaveFrame = -1;
+#endif
+
+// Video of every completed frame's visible area (+video=FILE), written by its own thread:
+VIDEO_WRITER    gVideo;
+
+
+// In windowed mode, the simulation runs in its own thread (see run_simulation()) while the main
+// thread owns SDL: It pumps events and presents frames. These are the two ways they talk...
+
+// ...Main thread => simulation thread: SDL events (other than those the main thread handles itself),
+// plus the latest keyboard state and accumulated relative mouse motion:
+typedef struct {
+  mutex               lock;
+  condition_variable  arrived;  // Signalled when events arrive (or we're quitting), e.g. to wake a paused sim.
+  deque<SDL_Event>    events;
+  Uint8               keys[SDL_NUM_SCANCODES];
+  int                 mouse_dx, mouse_dy;
+  bool                mouse_recenter;
+} sim_input_t;
+
+sim_input_t   gInput;
+Uint8         gKeys[SDL_NUM_SCANCODES];   // Simulation thread's copy of gInput.keys.
+int           gMouseDX, gMouseDY;         // Simulation thread's copy of mouse motion since the last refresh.
+
+// ...Simulation thread => main thread: Finished frames, each carrying a snapshot of everything
+// the HUD needs, so the main thread never touches TB or the design:
+typedef struct {
+  uint8_t         pixels[FRAMEBUFFER_SIZE];
+  fixed_vectors_t vectors;      // The design's vectors when this frame was published.
+  float_vectors_t overs;
+  bool            paused;
+  bool            guides;
+  bool            highlight;
+  bool            log_vsync;
+  bool            override_vectors;
+  bool            examine_mode;
+  bool            locks[LOCK__MAX];
+} sim_frame_t;
+
 
 // If part is 0, calculate from both the integer and fractional parts.
 // If <0, calculate from fractional part only.
@@ -303,6 +302,90 @@ uint32_t double2fixed(double d) {
   return t & ((1<<(Qm+Qn))-1);
 }
 
+// Write a full set of vectors (in the order: px, py, fx, fy, vx, vy) into the design's
+// SPI ready_buffer. The design reloads its vectors from ready_buffer at the end of every
+// visible frame, so this is a backdoor that makes the given vectors persist without SPI:
+void set_ready_buffer(const uint32_t* v) {
+  auto& rb = TB->m_core->DESIGN->ready_buffer; // 144 bits; playerX in [143:120], ... vplaneY in [23:0].
+  for (int w = 0; w < 5; ++w) rb[w] = 0;
+  for (int i = 0; i < 6; ++i) {
+    uint64_t val = v[i] & ((1<<(Qm+Qn))-1);
+    int lsb = (5-i)*(Qm+Qn);
+    rb[lsb/32] |= uint32_t(val << (lsb%32));
+    if (lsb%32 + (Qm+Qn) > 32) rb[lsb/32+1] |= uint32_t(val >> (32-lsb%32));
+  }
+}
+
+// Get vectors to the design's ready_buffer (via SPI, unless +spi_backdoor), so that it
+// loads them at the end of the visible frame, and every frame after that:
+void send_vectors(const uint32_t* v) {
+  gPokeInFlight = false; // Whatever poke_vectors() was waiting on is superseded by these.
+  if (gSpiBackdoor) set_ready_buffer(v); else gSpi->send(v);
+}
+
+void write_design_vectors(const uint32_t* v) {
+  TB->m_core->DESIGN->playerX = v[0];
+  TB->m_core->DESIGN->playerY = v[1];
+  TB->m_core->DESIGN->facingX = v[2];
+  TB->m_core->DESIGN->facingY = v[3];
+  TB->m_core->DESIGN->vplaneX = v[4];
+  TB->m_core->DESIGN->vplaneY = v[5];
+}
+
+// Put vectors straight into the design, and send them to ready_buffer too, so they stick.
+// Over SPI, they take ~600 ticks to get there: If the design loads ready_buffer before then,
+// it goes back to the old vectors, so end_of_line() checks and pokes these in again if so:
+void poke_vectors(const uint32_t* v) {
+  write_design_vectors(v);
+  send_vectors(v);
+  if (!gSpiBackdoor) {
+    memcpy(gPokedVectors, v, sizeof(gPokedVectors));
+    gPokeInFlight = true;
+  }
+}
+
+// Called once the design has loaded ready_buffer (i.e. after the last clock of V_LOAD_LINE):
+void repoke_vectors() {
+  if (gSpi->busy()) write_design_vectors(gPokedVectors); // They hadn't reached ready_buffer yet.
+  gPokeInFlight = false;
+}
+
+// Load one of gTestVectors (index 0..9) directly into the design, and make it stick:
+void load_test_vectors(int n) {
+  poke_vectors(gTestVectors[n]);
+}
+
+// Make whatever vectors the design currently has persist across frames:
+void hold_current_vectors() {
+  uint32_t v[6] = {
+    TB->m_core->DESIGN->playerX, TB->m_core->DESIGN->playerY,
+    TB->m_core->DESIGN->facingX, TB->m_core->DESIGN->facingY,
+    TB->m_core->DESIGN->vplaneX, TB->m_core->DESIGN->vplaneY
+  };
+  poke_vectors(v);
+}
+
+
+// Fill all of the design's ROMs straight from a binary ROM image (see sim/rom_image.h), as
+// written by `utils/asset_tool rom`. With +rom_image, the ROMs skip their own $readmemh:
+bool load_rom_image(const char *filename) {
+  ROM_IMAGE rom;
+  if (!rom.open(filename)) return false;
+  const uint8_t *textures = rom.section("texture", ROM_TEXTURES*ROM_TEXTURE_SIZE);
+  const uint8_t *sprite = rom.section("sprite", ROM_SPRITE_SIZE);
+  const uint8_t *map = rom.section("map", ROM_MAP_SIZE);
+  if (!textures || !sprite || !map) return false;
+  auto design = TB->m_core->DESIGN;
+  for (int t = 0; t < ROM_TEXTURES; ++t) {
+    for (int i = 0; i < ROM_TEXTURE_SIZE; ++i) design->wall_textures->data[t][i] = textures[t*ROM_TEXTURE_SIZE + i];
+  }
+  for (int i = 0; i < ROM_SPRITE_SIZE; ++i) design->sprites->data[i] = sprite[i];
+  fill_design_map(design->map, map);
+  printf("Loaded ROMs from %s\n", filename);
+  return true;
+}
+
+
 // Get current internal vectors from the design, so we can take them over
 // without disrupting the current view:
 void get_override_vectors() {
@@ -386,20 +469,38 @@ void recalc_override_vectors(const Uint8* k, int mouseX, int mouseY) {
 
 
 
-void set_override_vectors() {
-  // Convert gOvers to fixed-point values we can write back into the design:
+// gOvers as the fixed-point values that set_override_vectors() writes into the design:
+void get_override_fixed(uint32_t *v) {
+  v[0] = double2fixed(gOvers.px);
+  v[1] = double2fixed(gOvers.py);
+  v[2] = double2fixed(gOvers.fx);
+  v[3] = double2fixed(gOvers.fy);
+  v[4] = double2fixed(gOvers.vx);
+  v[5] = double2fixed(gOvers.vy);
+}
+
+// Write fixed-point override vectors (px, py, fx, fy, vx, vy) into the design:
+void write_override_vectors(const uint32_t *v) {
 #ifdef DESIGN_DIRECT_VECTOR_ACCESS
-  TB->m_core->new_playerX = double2fixed(gOvers.px);
-  TB->m_core->new_playerY = double2fixed(gOvers.py);
-  TB->m_core->new_facingX = double2fixed(gOvers.fx);
-  TB->m_core->new_facingY = double2fixed(gOvers.fy);
-  TB->m_core->new_vplaneX = double2fixed(gOvers.vx);
-  TB->m_core->new_vplaneY = double2fixed(gOvers.vy);
+  TB->m_core->new_playerX = v[0];
+  TB->m_core->new_playerY = v[1];
+  TB->m_core->new_facingX = v[2];
+  TB->m_core->new_facingY = v[3];
+  TB->m_core->new_vplaneX = v[4];
+  TB->m_core->new_vplaneY = v[5];
 #else//!DESIGN_DIRECT_VECTOR_ACCESS
-  #warning SPI vector access not yet implemented
+  // The design picks these up at the end of the visible frame:
+  send_vectors(v);
 #endif//DESIGN_DIRECT_VECTOR_ACCESS
 }
 
+void set_override_vectors() {
+  // Convert gOvers to fixed-point values we can write back into the design:
+  uint32_t v[6];
+  get_override_fixed(v);
+  write_override_vectors(v);
+}
+
 
 void activate_vectors_override() {
   gOverrideVectors = 1;
@@ -422,8 +523,11 @@ void toggle_mouse_capture(bool force = false, bool force_to = false) {
       printf("SDL_SetRelativeMouseMode(SDL_TRUE) failed (%d): %s\n", r, SDL_GetError());
     } else {
       printf("Mouse captured.\n");
-      gMouseX = 0;
-      gMouseY = 0;
+      // gMouseX/Y belong to the simulation thread, so get it to recentre them:
+      lock_guard<mutex> lk(gInput.lock);
+      gInput.mouse_recenter = true;
+      gInput.mouse_dx = 0;
+      gInput.mouse_dy = 0;
     }
   } else {
     int r = SDL_SetRelativeMouseMode(SDL_FALSE);
@@ -442,63 +546,20 @@ void scale_motion_multiplier(double s) {
 }
 
 
-class RawImage {
-public:
-  uint8_t* m_raw;
-  int width;
-  int height;
-  bool valid;
-  RawImage() {
-    width = 0;
-    height = 0;
-    m_raw = NULL;
-    valid = false;
-  }
-  RawImage(const char* texture_file, int expect_width=0, int expect_height=0) : RawImage() {
-    load_image(texture_file);
-  }
-  ~RawImage() {
-    if (m_raw) delete m_raw;
+void convert_image_rom_png_to_hex(const char *infile, const char *outfile, int width, int height) {
+  vector<uint8_t> data;
+  if (!load_png_rom(infile, width, height, false, data)) {
+    printf("ERROR: Image ROM file %s is invalid\n", infile);
+    return;
   }
-  void load_image(const char* f, int xw=0, int xh=0) {
-    SDL_Surface* s = IMG_Load(f);
-    if (!s) {
-      printf("ERROR: Failed to load texture image file '%s' due to error '%s'\n", f, SDL_GetError());
-      return;
-    }
-    width = s->w;
-    height = s->h;
-    if ( (xw && xw != width) || (xh && xh != height) ) {
-      printf("ERROR: Image '%s' should be %dx%d pixels, but is: %dx%d\n", f, xw, xh, width, height);
-      SDL_FreeSurface(s);
-      return;
-    }
-    Uint32 fmt = s->format->format;
-    if (fmt != SDL_PIXELFORMAT_RGB24) {
-      printf("ERROR: Image '%s' is wrong pixel format. Was expecting %x but got %x\n", f, SDL_PIXELFORMAT_RGB24, fmt);
-      SDL_FreeSurface(s);
-      return;
-    }
-    // Load raw image data...
-    SDL_LockSurface(s);
-    m_raw = new uint8_t[width*height*3];
-    for (int y = 0; y < height; ++y) {
-      // Copy line by line, because of s->pitch.
-      memcpy(m_raw + y*width*3, ((uint8_t*)(s->pixels)) + y*s->pitch, width*3 );
-    }
-    SDL_UnlockSurface(s);
-    // Done:
-    SDL_FreeSurface(s);
-    valid = true;
-  }
-  uint8_t* rgba(int x, int y) {
-    return m_raw+((y*width)+x)*3;
-  }
-  uint8_t r(int x, int y) { return rgba(x,y)[0]; }
-  uint8_t g(int x, int y) { return rgba(x,y)[1]; }
-  uint8_t b(int x, int y) { return rgba(x,y)[2]; }
-  // uint8_t a(int x, int y) { return rgba(x,y)[3]; }
-};
+  printf("Dumping Image ROM data to %s\n", outfile);
+  string hex;
+  rom_to_hex(data, hex);
+  FILE *f = fopen(outfile, "w");
+  fprintf(f, "@00000000\n");
+  fputs(hex.c_str(), f);
+  fclose(f);
+}
 
 
 // Texture file is expected to be a 24-bit PNG that is 128x64px, with the left
@@ -507,83 +568,212 @@ public:
 // compatible with how Raybox currently works. The code just picks off the
 // upper 2 bits of each channel anyway.
 void load_texture_rom(const char *texture_file) {
-  RawImage tex(texture_file, 128, 64);
-  if (!tex.valid) {
-    printf("ERROR: Texture ROM image %s is invalid\n", texture_file);
-    return;
-  } else {
-    printf("DEBUG: Loaded texture ROM image %s\n", texture_file);
+  convert_image_rom_png_to_hex(texture_file, "assets/texture-xrgb-2222.hex", 128, 64);
+}
+
+
+
+// Live asset loading: Each of the design's ROMs can be (re)loaded from a hex file ($readmemh format)
+// or a PNG (converted by sim/png_rom.h, as utils/asset_tool does) while the sim is running, by writing straight
+// into its verilator-public array. +texture1..3=FILE, +sprite=FILE and +map=FILE load them at startup.
+// L reloads all of them, and with +watch_assets, any that change on disk get reloaded automatically.
+// With +rom_image, that gets reloaded (and watched) in place of the default files.
+enum { ASSET_TEXTURE1, ASSET_TEXTURE2, ASSET_TEXTURE3, ASSET_SPRITE, ASSET_MAP, ASSET_COUNT };
+#define ASSET_ROM_IMAGE ASSET_COUNT // Not a ROM, just the id gAssetWatch reports the ROM image as.
+
+typedef struct {
+  const char *name;         // Also its plusarg.
+  const char *default_file; // Must match raybox_target_defs.v.
+  int width, height;        // Size of a PNG for it.
+  bool is_map;
+} asset_slot_t;
+
+static const asset_slot_t kAssetSlots[ASSET_COUNT] = {
+  { "texture1", "assets/blue-wall-xrgb2222.hex", 128, 64, false },
+  { "texture2", "assets/red-wall-xrgb2222.hex",  128, 64, false },
+  { "texture3", "assets/grey-wall-xrgb2222.hex", 128, 64, false },
+  { "sprite",   "assets/sprite-xrgb-2222.hex",    64, 64, false },
+  { "map",      "assets/map_16x16.hex",           64, 64, true  },
+};
+
+string          gAssetFiles[ASSET_COUNT];   // What each ROM was last loaded from (empty if gRomImage).
+string          gRomImage;                  // +rom_image, if any.
+ASSET_WATCH     gAssetWatch;
+bool            gWatchAssets = false;
+
+// Load one of the design's ROMs from a hex file or PNG:
+bool load_asset(int asset, const char *filename) {
+  const asset_slot_t &slot = kAssetSlots[asset];
+  size_t size = slot.is_map ? ROM_MAP_SIZE : asset == ASSET_SPRITE ? ROM_SPRITE_SIZE : ROM_TEXTURE_SIZE;
+  vector<uint8_t> data(size);
+  size_t len = strlen(filename);
+  bool is_png = len > 4 && 0 == SDL_strcasecmp(filename + len - 4, ".png");
+  if (is_png ? !load_png_rom(filename, slot.width, slot.height, slot.is_map, data) : !read_hex_rom(filename, data.data(), size)) {
+    printf("ERROR: Cannot load %s from %s\n", slot.name, filename);
+    return false;
   }
-  // Transfer texture image data into the design's wall_textures ROM,
-  // while also writing out to assets/texture-xrgb-2222.hex:
-  const char* tex_dump = "assets/texture-xrgb-2222.hex";
-  printf("Dumping texture data to %s\n", tex_dump);
-  FILE *f = fopen(tex_dump, "w");
-  fprintf(f, "@00000000\n");
-  int counter = 0;
-  for (int x=0; x<tex.width; ++x) {
-    for (int y=0; y<tex.height; ++y) {
-      uint8_t r = (tex.r(x, y) & 0xC0) >> 6; // Upper 2 bits only.
-      uint8_t g = (tex.g(x, y) & 0xC0) >> 6; // Upper 2 bits only.
-      uint8_t b = (tex.b(x, y) & 0xC0) >> 6; // Upper 2 bits only.
-      uint8_t v = (r<<4) | (g<<2) | (b);
-      // TB->m_core->DESIGN->wall_textures->data[x][y] = v;
-      fprintf(f, "%02X%c", v, counter%16==15 ? '\n' : ' ');
-      ++counter;
-    }
+  auto design = TB->m_core->DESIGN;
+  switch (asset) {
+    case ASSET_TEXTURE1: case ASSET_TEXTURE2: case ASSET_TEXTURE3:
+      for (size_t i = 0; i < size; ++i) design->wall_textures->data[asset-ASSET_TEXTURE1][i] = data[i];
+      break;
+    case ASSET_SPRITE:
+      for (size_t i = 0; i < size; ++i) design->sprites->data[i] = data[i];
+      break;
+    case ASSET_MAP:
+      fill_design_map(design->map, data.data());
+      break;
   }
-  printf("DEBUG: Transferred texture ROM into raybox.wall_textures\n");
-  fclose(f);
+  gAssetFiles[asset] = filename;
+  printf("Loaded %s from %s\n", slot.name, filename);
+  return true;
 }
 
+// Load the ROM image (+rom_image) and any assets given as plusargs, and start watching them all if +watch_assets:
+bool init_assets() {
+  gWatchAssets = has_plusarg("watch_assets");
+  if (get_plusarg("rom_image", gRomImage)) {
+    if (!load_rom_image(gRomImage.c_str())) return false;
+    if (gWatchAssets) gAssetWatch.add(ASSET_ROM_IMAGE, gRomImage);
+  }
+  for (int a = 0; a < ASSET_COUNT; ++a) {
+    string file;
+    if (get_plusarg(kAssetSlots[a].name, file)) {
+      if (!load_asset(a, file.c_str())) return false;
+    } else {
+      gAssetFiles[a] = gRomImage.empty() ? kAssetSlots[a].default_file : "";
+    }
+    if (gWatchAssets && !gAssetFiles[a].empty()) gAssetWatch.add(a, gAssetFiles[a]);
+  }
+  if (gWatchAssets) printf("Watching assets for changes\n");
+  return true;
+}
 
-
-void convert_image_rom_png_to_hex(const char *infile, const char *outfile, int width, int height) {
-  RawImage image(infile, width, height);
-  if (!image.valid) {
-    printf("ERROR: Image ROM file %s is invalid\n", infile);
-    return;
-  } else {
-    printf("DEBUG: Loaded Image ROM %s\n", infile);
+// SIMULATION thread: Reload all assets (force), or just those that have changed on disk (if watching):
+void reload_assets(bool force) {
+  vector<int> changed;
+  if (force) {
+    for (int a = 0; a <= ASSET_ROM_IMAGE; ++a) changed.push_back(a);
+  } else if (gWatchAssets) {
+    changed = gAssetWatch.poll();
   }
-  printf("Dumping Image ROM data to %s\n", outfile);
-  FILE *f = fopen(outfile, "w");
-  fprintf(f, "@00000000\n");
-  int counter = 0;
-  for (int x=0; x<image.width; ++x) {
-    for (int y=0; y<image.height; ++y) {
-      uint8_t r = (image.r(x, y) & 0xC0) >> 6; // Upper 2 bits only.
-      uint8_t g = (image.g(x, y) & 0xC0) >> 6; // Upper 2 bits only.
-      uint8_t b = (image.b(x, y) & 0xC0) >> 6; // Upper 2 bits only.
-      uint8_t v = (r<<4) | (g<<2) | (b);
-      fprintf(f, "%02X%c", v, counter%16==15 ? '\n' : ' ');
-      ++counter;
+  // The ROM image fills every ROM, so it goes first, then any ROMs loaded from their own files go back on top:
+  if (!gRomImage.empty() && std::find(changed.begin(), changed.end(), ASSET_ROM_IMAGE) != changed.end()) {
+    if (load_rom_image(gRomImage.c_str())) {
+      changed.clear();
+      for (int a = 0; a < ASSET_COUNT; ++a) changed.push_back(a);
+    } else if (gWatchAssets) {
+      gAssetWatch.retry(ASSET_ROM_IMAGE);
     }
   }
-  fclose(f);
+  for (int a : changed) {
+    if (a == ASSET_ROM_IMAGE || gAssetFiles[a].empty()) continue; // Done above, or comes from the ROM image.
+    if (!load_asset(a, gAssetFiles[a].c_str()) && gWatchAssets) gAssetWatch.retry(a); // Maybe still being written.
+  }
 }
 
 
 
-void process_sdl_events() {
+// Signal the simulation thread to stop, and wake it up if it's waiting for input:
+void quit_simulation() {
+  lock_guard<mutex> lk(gInput.lock);
+  gQuit = true;
+  gInput.arrived.notify_all();
+}
+
+
+
+// MAIN thread: Pump SDL events. Those that need the main thread (quit, mouse capture) are handled
+// here, and everything else is queued for the simulation thread, along with input device state.
+void forward_sdl_events() {
   // Event used to receive window close, keyboard actions, etc:
   SDL_Event e;
+  bool forwarded = false;
   // Consume SDL events, if any, until the event queue is empty:
   while (SDL_PollEvent(&e) == 1) {
     if (SDL_QUIT == e.type) {
       // SDL quit event (e.g. close window)?
-      gQuit = true;
-    // } else if (SDL_MOUSEMOTION == e.type) {
-    //   int x = e.motion.xrel;
-    //   int y = e.motion.yrel;
-    //   printf("\t\t\t\t\t\t\t\t\t\t\t\t\tMouse motion: %d, %d\n", x, y);
+      quit_simulation();
     } else if (SDL_KEYDOWN == e.type) {
-      int fn_key = 0;
       switch (e.key.keysym.sym) {
         case SDLK_F12:
           // Toggle mouse capture.
           toggle_mouse_capture();
           break;
+        case SDLK_q:
+        case SDLK_ESCAPE:
+          // ESC or Q key pressed, for Quit
+          quit_simulation();
+          break;
+        default: {
+          lock_guard<mutex> lk(gInput.lock);
+          gInput.events.push_back(e);
+          forwarded = true;
+          break;
+        }
+      }
+    }
+  }
+  // Make the latest keyboard and mouse state available to the simulation thread:
+  int mouseX = 0, mouseY = 0;
+  if (gMouseCapture) SDL_GetRelativeMouseState(&mouseX, &mouseY);
+  lock_guard<mutex> lk(gInput.lock);
+  memcpy(gInput.keys, SDL_GetKeyboardState(NULL), SDL_NUM_SCANCODES);
+  gInput.mouse_dx += mouseX;
+  gInput.mouse_dy += mouseY;
+  if (forwarded) gInput.arrived.notify_all();
+}
+
+
+
+// SIMULATION thread: Block until the main thread sends events, or we're quitting:
+void wait_for_input() {
+  unique_lock<mutex> lk(gInput.lock);
+  gInput.arrived.wait(lk, []{ return gQuit || !gInput.events.empty(); });
+}
+
+
+
+// Keys that change how many ticks simulate_refresh() runs for:
+bool is_refresh_key(SDL_Keycode key) {
+  switch (key) {
+    case SDLK_1: case SDLK_2: case SDLK_3: case SDLK_4: case SDLK_5:
+    case SDLK_6: case SDLK_8: case SDLK_9: case SDLK_KP_PLUS: case SDLK_KP_MINUS:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool refresh_locked() {
+  return gRecorder.is_open() || gPlayer.loaded();
+}
+
+// SIMULATION thread: Take whatever input the main thread has forwarded, and act on any events:
+void process_sdl_events() {
+  deque<SDL_Event> events;
+  {
+    lock_guard<mutex> lk(gInput.lock);
+    events.swap(gInput.events);
+    memcpy(gKeys, gInput.keys, SDL_NUM_SCANCODES);
+    gMouseDX = gInput.mouse_dx;
+    gMouseDY = gInput.mouse_dy;
+    gInput.mouse_dx = 0;
+    gInput.mouse_dy = 0;
+    if (gInput.mouse_recenter) {
+      gMouseX = 0;
+      gMouseY = 0;
+      gInput.mouse_recenter = false;
+    }
+  }
+  for (auto &e : events) {
+    if (SDL_KEYDOWN == e.type) {
+      if (refresh_locked() && is_refresh_key(e.key.keysym.sym)) {
+        printf("Refresh is locked to whole frames while recording or replaying inputs\n");
+        continue;
+      }
+      int fn_key = 0;
+      switch (e.key.keysym.sym) {
         case SDLK_F10:++fn_key;
         case SDLK_F9: ++fn_key;
         case SDLK_F8: ++fn_key;
@@ -595,24 +785,18 @@ void process_sdl_events() {
         case SDLK_F2: ++fn_key;
         case SDLK_F1: ++fn_key;
           {
+            if (gPlayer.loaded()) {
+              printf("Ignoring F%d during replay\n", fn_key);
+              break;
+            }
             // Directly set override vectors...
             printf("Loading state #%d\n", fn_key);
-            uint32_t* v = gTestVectors[fn_key-1];
-            TB->m_core->DESIGN->playerX = *(v++);
-            TB->m_core->DESIGN->playerY = *(v++);
-            TB->m_core->DESIGN->facingX = *(v++);
-            TB->m_core->DESIGN->facingY = *(v++);
-            TB->m_core->DESIGN->vplaneX = *(v++);
-            TB->m_core->DESIGN->vplaneY = *(v++);
+            load_test_vectors(fn_key-1);
+            gPendingPose = fn_key;
             // ...then activate vectors override (which will reload gOvers from what we just set above):
             activate_vectors_override();
             break;
           }
-        case SDLK_q:
-        case SDLK_ESCAPE:
-          // ESC or Q key pressed, for Quit
-          gQuit = true;
-          break;
         case SDLK_SPACE:
           TB->pause(!TB->paused);
           break;
@@ -714,14 +898,39 @@ void process_sdl_events() {
             TB->pause(true);
           }
           break;
+#ifdef TRACE
+        case SDLK_t:
+          // Waves: T triggers, Shift+T arms/disarms:
+          if (KMOD_SHIFT & e.key.keysym.mod) gWaves.arm(!gWaves.armed() && !gWaves.capturing(), TB->frame_counter);
+          else gWaves.trigger("T key", TB->frame_counter);
+          break;
+#endif
+        case SDLK_k:
+          // Checkpoint: K saves, Shift+K restores (see service_checkpoints()):
+          if (KMOD_SHIFT & e.key.keysym.mod) gRestoreCheckpoint = true;
+          else gSaveCheckpoint = true;
+          break;
         case SDLK_s: // Step-examine, basically the same as hitting X then P while already paused.
           TB->examine_mode = true;
           TB->examine_condition_met = false;
           TB->pause(false); // Unpause.
           break;
+        case SDLK_c:
+          gCheckTraces = !gCheckTraces;
+          gLastCheckFailed = false;
+          if (gCheckTraces) {
+            printf("Trace checking ON\n");
+          }
+          else {
+            printf("Trace checking off (%d frame(s) checked, %d mismatched)\n", gCheckedFrames, gMismatchedFrames);
+          }
+          break;
         case SDLK_f:
           printf("Stepping by 1 frame is not yet implemented!\n");
           break;
+        case SDLK_l:
+          reload_assets(true);
+          break;
         case SDLK_o:
           gOverrideVectors = !gOverrideVectors;
           if (!gOverrideVectors) {
@@ -754,7 +963,8 @@ void process_sdl_events() {
               // NOTE: If SHIFT is held, send momentary (1-frame) signal inputs instead of locks.
               //SMELL: This won't work if we're calling handle_control_inputs more often than once per frame...?
 #else//!DESIGN_DIRECT_VECTOR_ACCESS
-              #warning SPI vector access not yet implemented
+              //NOTE: Without DESIGN_DIRECT_VECTOR_ACCESS there are no movement inputs: The design only moves
+              // when it gets new vectors over SPI, i.e. in Override Vectors mode.
 #endif//DESIGN_DIRECT_VECTOR_ACCESS
             }
           }
@@ -769,12 +979,66 @@ void set_write_new_position(int assert) {
 #ifdef DESIGN_DIRECT_VECTOR_ACCESS
   TB->m_core->write_new_position = assert;
 #else//!DESIGN_DIRECT_VECTOR_ACCESS
-  #warning SPI vector access not yet implemented
+  // Nothing to do: Over SPI, the design loads whatever vectors it last received at the end of every visible frame.
 #endif//DESIGN_DIRECT_VECTOR_ACCESS
 }
 
 
 
+// Record the inputs that handle_control_inputs() just applied, as the next frame of the input log:
+void record_inputs() {
+  if (!gRecorder.is_open()) return;
+  input_frame_t in = {};
+  in.reset    = TB->m_core->reset;
+  in.show_map = TB->m_core->show_map;
+#ifdef DESIGN_DIRECT_VECTOR_ACCESS
+  in.moveF    = TB->m_core->moveF;
+  in.moveL    = TB->m_core->moveL;
+  in.moveB    = TB->m_core->moveB;
+  in.moveR    = TB->m_core->moveR;
+#endif//DESIGN_DIRECT_VECTOR_ACCESS
+  in.pose     = gPendingPose;
+  in.override = gOverrideVectors;
+  if (gOverrideVectors) get_override_fixed(in.vectors);
+  gPendingPose = 0;
+  gRecorder.frame(in);
+}
+
+// Apply the next frame's inputs from the input log, instead of what the keyboard and mouse say.
+// Returns false (and stops replaying) once the log has ended.
+bool replay_inputs() {
+  input_frame_t in;
+  if (!gPlayer.frame(gInputFrame, in)) {
+    printf("Replay finished after %lu frame(s)\n", gInputFrame);
+    gPlayer.unload();
+    return false;
+  }
+  ++gInputFrame;
+  if (in.pose >= 1 && in.pose <= 10) load_test_vectors(in.pose-1);
+  TB->m_core->show_debug = 1;
+  TB->m_core->reset     = in.reset;
+  TB->m_core->show_map  = in.show_map;
+#ifdef DESIGN_DIRECT_VECTOR_ACCESS
+  TB->m_core->moveF     = in.moveF;
+  TB->m_core->moveL     = in.moveL;
+  TB->m_core->moveB     = in.moveB;
+  TB->m_core->moveR     = in.moveR;
+#endif//DESIGN_DIRECT_VECTOR_ACCESS
+  gOverrideVectors = in.override;
+  if (in.override) {
+    write_override_vectors(in.vectors);
+    // Keep gOvers in step, so the guides show the same thing they did when recording:
+    gOvers = {
+      fixed2double(in.vectors[0]), fixed2double(in.vectors[1]), fixed2double(in.vectors[2]),
+      fixed2double(in.vectors[3]), fixed2double(in.vectors[4]), fixed2double(in.vectors[5])
+    };
+  }
+  set_write_new_position(in.override);
+  return true;
+}
+
+
+
 //NOTE: handle_control_inputs is called twice; once with `true` before process_sdl_events, then once after with `false`.
 void handle_control_inputs(bool prepare) {
   if (prepare) {
@@ -786,8 +1050,6 @@ void handle_control_inputs(bool prepare) {
       TB->m_core->moveL     = 0;
       TB->m_core->moveB     = 0;
       TB->m_core->moveR     = 0;
-  #else//!DESIGN_DIRECT_VECTOR_ACCESS
-      #warning SPI vector access not yet implemented
   #endif//DESIGN_DIRECT_VECTOR_ACCESS
 
 #ifdef DEBUG_BUTTON_INPUTS
@@ -797,21 +1059,21 @@ void handle_control_inputs(bool prepare) {
     TB->m_core->debugD    = 0;
 #endif // DEBUG_BUTTON_INPUTS
   }
+  else if (gPlayer.loaded() && replay_inputs()) {
+    // ACTIVE mode, but the input log has supplied this frame's inputs (which can be recorded again):
+    record_inputs();
+  }
   else {
 
-    int mouseX, mouseY;
-    if (gMouseCapture) {
-      uint32_t buttons = SDL_GetRelativeMouseState(&mouseX, &mouseY);
-      gMouseX += mouseX;
-      gMouseY += mouseY;
-      // printf("\t\t\t\t\t\t\t\t\t\tMouse motion: %6d, %6d\tGlobal pos: %7d, %7d\n", mouseX, mouseY, gMouseX, gMouseY);
-    } else {
-      mouseX = 0;
-      mouseY = 0;
-    }
+    // Relative mouse motion (only collected by the main thread while the mouse is captured):
+    int mouseX = gMouseDX;
+    int mouseY = gMouseDY;
+    gMouseX += mouseX;
+    gMouseY += mouseY;
+    // printf("\t\t\t\t\t\t\t\t\t\tMouse motion: %6d, %6d\tGlobal pos: %7d, %7d\n", mouseX, mouseY, gMouseX, gMouseY);
 
     // ACTIVE mode: Read the momentary state of all keyboard keys, and add them via `|=` to whatever is already asserted:
-    auto keystate = SDL_GetKeyboardState(NULL);
+    auto keystate = gKeys;
 
     if (gOverrideVectors) {
       recalc_override_vectors(keystate, mouseX, mouseY);
@@ -830,8 +1092,6 @@ void handle_control_inputs(bool prepare) {
       TB->m_core->moveL     |= keystate[SDL_SCANCODE_A   ] | gLockInputs[LOCK_L];
       TB->m_core->moveB     |= keystate[SDL_SCANCODE_S   ] | gLockInputs[LOCK_B];
       TB->m_core->moveR     |= keystate[SDL_SCANCODE_D   ] | gLockInputs[LOCK_R];
-    #else//!DESIGN_DIRECT_VECTOR_ACCESS
-      #warning SPI vector access not yet implemented
     #endif//DESIGN_DIRECT_VECTOR_ACCESS
 
 #ifdef DEBUG_BUTTON_INPUTS
@@ -840,163 +1100,1064 @@ void handle_control_inputs(bool prepare) {
     TB->m_core->debugC    |= keystate[SDL_SCANCODE_KP_2];
     TB->m_core->debugD    |= keystate[SDL_SCANCODE_KP_8];
 #endif // DEBUG_BUTTON_INPUTS
+
+    record_inputs();
   }
 }
 
 
 
-void check_performance() {
-  auto time_now = SDL_GetTicks();
-  int time_delta = time_now-gPrevTime;
+// Where host time goes, phase by phase, written out every +metrics_interval if +metrics=FILE is given.
+// The windowed sim also has it print FPS and simulated Hz to stdout every interval:
+METRICS gMetrics;
 
-  if (time_delta >= 1000) {
-    // 1S+ has elapsed, so print FPS:
-    printf("Current FPS: %5.2f", float(TB->frame_counter-gPrevFrames)/float(time_delta)*1000.0f);
-    // Estimate clock speed based on delta of m_tickcount:
-    long hz = (TB->m_tickcount-gPrevTickCount)*1000L / time_delta;
-    // Now print long-term average:
-    printf(" - Total average FPS: %5.2f", float(TB->frame_counter)/float(time_now-gOriginalTime)*1000.0f);
-    printf(" - m_tickcount=");
-    TB->print_big_num(TB->m_tickcount);
-    printf(" (");
-    TB->print_big_num(hz);
-    printf(" Hz; %3ld%% of target)\n", (hz*100)/CLOCK_HZ);
-    gPrevTime = SDL_GetTicks();
-    gPrevFrames = TB->frame_counter;
-    gPrevTickCount = TB->m_tickcount;
-  }
-}
 
 
+// Range of framebuffer rows that simulate_refresh() has written (with highlighting) since
+// clear_freshness() last ran. Starts out as "everything", because the framebuffer starts as junk:
+int gDirtyTop = 0;
+int gDirtyBottom = VFULL-1;
+// Whether the overflow region (beyond HFULL,VFULL) might still have something in it to fade out:
+bool gOverflowDirty = true;
+
+void mark_dirty_rows(int top, int bottom) {
+  if (bottom >= VFULL) bottom = VFULL-1;
+  if (top < gDirtyTop) gDirtyTop = top;
+  if (bottom > gDirtyBottom) gDirtyBottom = bottom;
+}
 
 void clear_freshness(uint8_t *fb) {
-  // If we're not refreshing at least one full frame at a time,
-  // then clear the "freshness" of pixels that haven't been updated.
-  // We make this conditional in the hopes of getting extra speed
-  // for higher refresh rates.
-  // if (gRefreshLimit < REFRESH_FRAME) {
-    // In this simulation, the 6 lower bits of each colour channel
-    // are not driven by the design, and so we instead use them to
-    // help visualise what region of the framebuffer has been updated
-    // between SDL window refreshes (by the rendering loop forcing them on,
-    // which appears as a slight brightening).
-    // THIS loop clears all that between refreshes:
-    for (int x = 0; x < HFULL; ++x) {
-      for (int y = 0; y < VFULL; ++y) {
-        fb[(x+y*WINDOW_WIDTH)*4 + 0] &= ~HILITE;
-        fb[(x+y*WINDOW_WIDTH)*4 + 1] &= ~HILITE;
-        fb[(x+y*WINDOW_WIDTH)*4 + 2] &= ~HILITE;
-      }
-    }
-  // }
+  // In this simulation, the 6 lower bits of each colour channel
+  // are not driven by the design, and so we instead use them to
+  // help visualise what region of the framebuffer has been updated
+  // between SDL window refreshes (by the rendering loop forcing them on,
+  // which appears as a slight brightening).
+  // THIS clears all that between refreshes, but only in rows that were
+  // actually written: Whole rows are contiguous, so this is one straight pass.
+  if (gDirtyTop > gDirtyBottom) return;
+  fb_and(
+    (uint32_t*)fb + gDirtyTop*WINDOW_WIDTH,
+    (gDirtyBottom-gDirtyTop+1)*WINDOW_WIDTH,
+    ~PIXEL_RGB(HILITE)
+  );
+  gDirtyTop = VFULL;
+  gDirtyBottom = -1;
 }
 
 void overlay_display_area_frame(uint8_t *fb, int h_shift = 0, int v_shift = 0) {
   // if (!gGuides) return;
+  uint32_t *p = (uint32_t*)fb;
+  const uint32_t frame_line = PIXEL_RGB(0b0100'0000);
+  const uint32_t guide_line = PIXEL_RGB(0b0110'0000);
   // Vertical range: Horizontal lines (top and bottom):
   if (v_shift > 0) {
-    for (int x = 0; x < WINDOW_WIDTH; ++x) {
-      fb[(x+(v_shift-1)*WINDOW_WIDTH)*4 + 0] |= 0b0100'0000;
-      fb[(x+(v_shift-1)*WINDOW_WIDTH)*4 + 1] |= 0b0100'0000;
-      fb[(x+(v_shift-1)*WINDOW_WIDTH)*4 + 2] |= 0b0100'0000;
-    }
+    fb_or(p + (v_shift-1)*WINDOW_WIDTH, WINDOW_WIDTH, frame_line);
   }
   if (v_shift+VDA < WINDOW_HEIGHT) {
-    for (int x = 0; x < WINDOW_WIDTH; ++x) {
-      fb[(x+(VDA+v_shift)*WINDOW_WIDTH)*4 + 0] |= 0b0100'0000;
-      fb[(x+(VDA+v_shift)*WINDOW_WIDTH)*4 + 1] |= 0b0100'0000;
-      fb[(x+(VDA+v_shift)*WINDOW_WIDTH)*4 + 2] |= 0b0100'0000;
-    }
+    fb_or(p + (VDA+v_shift)*WINDOW_WIDTH, WINDOW_WIDTH, frame_line);
   }
   // Horizontal range: Vertical lines (left and right sides):
   if (h_shift > 0) {
-    for (int y = 0; y < WINDOW_HEIGHT; ++y) {
-      fb[(h_shift-1+y*WINDOW_WIDTH)*4 + 0] |= 0b0100'0000;
-      fb[(h_shift-1+y*WINDOW_WIDTH)*4 + 1] |= 0b0100'0000;
-      fb[(h_shift-1+y*WINDOW_WIDTH)*4 + 2] |= 0b0100'0000;
-    }
+    for (int y = 0; y < WINDOW_HEIGHT; ++y) p[h_shift-1 + y*WINDOW_WIDTH] |= frame_line;
   }
   if (h_shift+HDA < WINDOW_WIDTH) {
-    for (int y = 0; y < WINDOW_HEIGHT; ++y) {
-      fb[(HDA+h_shift+y*WINDOW_WIDTH)*4 + 0] |= 0b0100'0000;
-      fb[(HDA+h_shift+y*WINDOW_WIDTH)*4 + 1] |= 0b0100'0000;
-      fb[(HDA+h_shift+y*WINDOW_WIDTH)*4 + 2] |= 0b0100'0000;
-    }
+    for (int y = 0; y < WINDOW_HEIGHT; ++y) p[HDA+h_shift + y*WINDOW_WIDTH] |= frame_line;
   }
   // Guides:
   if (gGuides) {
     // Mid-screen vertical line:
-    for (int y = 0; y < WINDOW_HEIGHT; ++y) {
-        fb[(HDA/2+h_shift+y*WINDOW_WIDTH)*4 + 0] |= 0b0110'0000;
-        fb[(HDA/2+h_shift+y*WINDOW_WIDTH)*4 + 1] |= 0b0110'0000;
-        fb[(HDA/2+h_shift+y*WINDOW_WIDTH)*4 + 2] |= 0b0110'0000;
-    }
+    for (int y = 0; y < WINDOW_HEIGHT; ++y) p[HDA/2+h_shift + y*WINDOW_WIDTH] |= guide_line;
     // Mouse crosshairs:
     // X axis, vertical line:
     int mx = gMouseX + HDA/2;
     int my = gMouseY + VDA/2;
     if (mx >= 0 && mx < HDA) {
-      for (int y = 0; y < WINDOW_HEIGHT; ++y) {
-          fb[(mx+h_shift+y*WINDOW_WIDTH)*4 + 0] |= 0b0110'0000;
-          fb[(mx+h_shift+y*WINDOW_WIDTH)*4 + 1] |= 0b0110'0000;
-          fb[(mx+h_shift+y*WINDOW_WIDTH)*4 + 2] |= 0b0110'0000;
-      }
+      for (int y = 0; y < WINDOW_HEIGHT; ++y) p[mx+h_shift + y*WINDOW_WIDTH] |= guide_line;
     }
     if (my >= 0 && my < VDA) {
-      for (int x = 0; x < WINDOW_WIDTH; ++x) {
-          fb[(x+(my+v_shift)*WINDOW_WIDTH)*4 + 0] |= 0b0110'0000;
-          fb[(x+(my+v_shift)*WINDOW_WIDTH)*4 + 1] |= 0b0110'0000;
-          fb[(x+(my+v_shift)*WINDOW_WIDTH)*4 + 2] |= 0b0110'0000;
-      }
+      fb_or(p + (my+v_shift)*WINDOW_WIDTH, WINDOW_WIDTH, guide_line);
     }
   }
 }
 
 
+// Fade out anything in the overflow region (which the design should never write to).
+// Once it's all faded to black, this does nothing until overflow_test() puts something there again.
 void fade_overflow_region(uint8_t *fb) {
-  for (int x = HFULL; x < WINDOW_WIDTH; ++x) {
-    for (int y = 0 ; y < VFULL; ++y) {
-      fb[(x+y*WINDOW_WIDTH)*4 + 0] *= 0.95;
-      fb[(x+y*WINDOW_WIDTH)*4 + 1] *= 0.95;
-      fb[(x+y*WINDOW_WIDTH)*4 + 2] *= 0.95;
+  if (!gOverflowDirty) return;
+  uint32_t *p = (uint32_t*)fb;
+  bool any = false;
+  // Right-hand side of each line:
+  for (int y = 0; y < VFULL; ++y) {
+    any |= fb_fade(p + y*WINDOW_WIDTH + HFULL, WINDOW_WIDTH-HFULL);
+  }
+  // All full lines below VFULL, in one go:
+  any |= fb_fade(p + VFULL*WINDOW_WIDTH, (WINDOW_HEIGHT-VFULL)*WINDOW_WIDTH);
+  gOverflowDirty = any;
+}
+
+
+void overflow_test(uint8_t *fb) {
+  uint32_t *p = (uint32_t*)fb;
+  const uint32_t c = (255<<16) | (150<<8) | 50; // R=255, G=150, B=50.
+  for (int y = 0; y < VFULL; ++y) {
+    fb_fill(p + y*WINDOW_WIDTH + HFULL, WINDOW_WIDTH-HFULL, c);
+  }
+  fb_fill(p + VFULL*WINDOW_WIDTH, (WINDOW_HEIGHT-VFULL)*WINDOW_WIDTH, c);
+  gOverflowDirty = true;
+}
+
+
+
+// Re-arm the one-shot line/frame sync that simulate_refresh() uses to line up refreshes with
+// the design's own scan position, based on the current refresh mode (e.g. after a reset).
+void resync_refresh() {
+  gSyncLine  = (gRefreshLimit % REFRESH_LINE  == 0);
+  gSyncFrame = (gRefreshLimit % REFRESH_FRAME == 0);
+}
+
+
+
+// The design's current vectors:
+fixed_vectors_t design_vectors() {
+  return {
+    TB->m_core->DESIGN->playerX, TB->m_core->DESIGN->playerY,
+    TB->m_core->DESIGN->facingX, TB->m_core->DESIGN->facingY,
+    TB->m_core->DESIGN->vplaneX, TB->m_core->DESIGN->vplaneY
+  };
+}
+
+
+
+// What the tracer actually stored in trace_buffer for a column:
+tracer_column_t design_trace(int col) {
+  auto *traces = TB->m_core->DESIGN->traces;
+  tracer_column_t t = {};
+  t.vdist = traces->dummy_vdist_memory[col];
+  t.tex   = traces->dummy_tex_memory[col];
+  t.wtid  = traces->dummy_wtid_memory[col];
+  t.side  = traces->dummy_side_memory[col];
+  return t;
+}
+
+bool same_trace(const tracer_column_t &a, const tracer_column_t &b) {
+  return a.vdist == b.vdist && a.tex == b.tex && a.wtid == b.wtid && a.side == b.side;
+}
+
+// Compare what the tracer wrote into trace_buffer during the VBLANK that just ended with what
+// TRACER_MODEL says it should be for vec and the design's own map. Only the columns that the
+// tracer could finish within VBLANK (vblank_clocks, as measured by the sim) are compared,
+// because the rest still hold older traces.
+// Returns the number of mismatching columns. If verbose, the first one is reported in full.
+int check_traces(const fixed_vectors_t &vec, long vblank_clocks, bool verbose) {
+  //NOTE: This assumes the design's MAP_SIZE_BITS matches the model's default (6, i.e. 64x64).
+  static TRACER_MODEL model;
+  static tracer_column_t expect[TRACER_MODEL::kColumns];
+  auto *map = TB->m_core->DESIGN->map;
+  int size = 1 << model.map_size_bits();
+  for (int col = 0; col < size; ++col) {
+    for (int row = 0; row < size; ++row) model.set_map(col, row, map->dummy_memory[col][row]);
+  }
+  tracer_vectors_t tv = { vec.px, vec.py, vec.fx, vec.fy, vec.vx, vec.vy };
+  int total = model.trace_frame(tv, expect);
+  int finished = 0;
+  for (int clocks = 1; finished < TRACER_MODEL::kColumns; ++finished) {
+    clocks += expect[finished].cycles;
+    if (clocks > vblank_clocks) break;
+  }
+
+  int mismatches = 0;
+  int first = -1;
+  for (int col = 0; col < finished; ++col) {
+    if (!same_trace(design_trace(col), expect[col])) {
+      if (first < 0) first = col;
+      ++mismatches;
     }
   }
-  for (int x = 0; x < WINDOW_WIDTH; ++x) {
-    for (int y = VFULL; y < WINDOW_HEIGHT; ++y) {
-      fb[(x+y*WINDOW_WIDTH)*4 + 0] *= 0.95;
-      fb[(x+y*WINDOW_WIDTH)*4 + 1] *= 0.95;
-      fb[(x+y*WINDOW_WIDTH)*4 + 2] *= 0.95;
+  if (mismatches) {
+    printf("Trace check: %d of %d column(s) differ; first is column %d\n", mismatches, finished, first);
+  }
+  if (verbose && mismatches) {
+    const tracer_column_t &e = expect[first];
+    tracer_column_t d = design_trace(first);
+    printf("  Vectors: p=(%lf, %lf) f=(%lf, %lf) v=(%lf, %lf)\n",
+      fixed2double(vec.px), fixed2double(vec.py), fixed2double(vec.fx),
+      fixed2double(vec.fy), fixed2double(vec.vx), fixed2double(vec.vy));
+    printf("           { 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X }\n",
+      vec.px, vec.py, vec.fx, vec.fy, vec.vx, vec.vy);
+    printf("  Ray:     rayDir=(%lf, %lf) steps=%d cycles=%d%s\n",
+      fixed2double(e.rayDirX), fixed2double(e.rayDirY), e.steps, e.cycles, e.hit ? "" : " (NO WALL HIT)");
+    printf("           RTL                 Model\n");
+    printf("  vdist:   0x%04X (%10.6lf)  0x%04X (%10.6lf)%s\n",
+      d.vdist, d.vdist/512.0, e.vdist, e.vdist/512.0, d.vdist != e.vdist ? "  <==" : "");
+    printf("  side:    %-18d  %d%s\n", d.side, e.side, d.side != e.side ? "  <==" : "");
+    printf("  wtid:    %-18d  %d%s\n", d.wtid, e.wtid, d.wtid != e.wtid ? "  <==" : "");
+    printf("  tex:     %-18d  %d%s\n", d.tex,  e.tex,  d.tex  != e.tex  ? "  <==" : "");
+    // A little context either side, to help tell a single glitched column from a wider error:
+    printf("  Nearby vdist (RTL/model):");
+    for (int col = max(0, first-3); col <= min(finished-1, first+3); ++col) {
+      printf(" %d:%04X/%04X%s", col, design_trace(col).vdist, expect[col].vdist, col == first ? "*" : "");
     }
+    printf("\n");
+  }
+  if (verbose && finished < TRACER_MODEL::kColumns) {
+    printf(
+      "Trace check: NOTE: Tracer needs %d clocks, so only %d of %d columns finish within VBLANK\n",
+      total, finished, TRACER_MODEL::kColumns
+    );
   }
+  return mismatches;
 }
 
+// Append everything in trace_buffer (plus the vectors that produced it) to gCapture:
+void capture_traces(const fixed_vectors_t &vec) {
+  static trace_record_t record;
+  record.frame = TB->frame_counter;
+  record.flags = 0;
+  uint32_t v[6] = { vec.px, vec.py, vec.fx, vec.fy, vec.vx, vec.vy };
+  memcpy(record.vectors, v, sizeof(v));
+  for (int col = 0; col < TRACE_CAPTURE_COLUMNS; ++col) {
+    tracer_column_t t = design_trace(col);
+    record.columns[col] = trace_pack(t.vdist, t.tex, t.wtid, t.side);
+  }
+  gCapture.write(record);
+}
 
-void overflow_test(uint8_t *fb) {
-  for (int x = HFULL; x < WINDOW_WIDTH; ++x) {
-    for (int y = 0 ; y < VFULL; ++y) {
-      fb[(x+y*WINDOW_WIDTH)*4 + 0] = 50;
-      fb[(x+y*WINDOW_WIDTH)*4 + 1] = 150;
-      fb[(x+y*WINDOW_WIDTH)*4 + 2] = 255;
+void close_recording() {
+  if (!gRecorder.is_open()) return;
+  gRecorder.close();
+  printf("Input recording: %lu frame(s) written\n", gRecorder.frames());
+}
+
+void close_capture() {
+  if (!gCapture.is_open()) return;
+  gCapture.close();
+  printf("Trace capture: %lu frame(s) written\n", gCapture.records());
+}
+
+// Called by simulate_refresh() at the end of every frame while trace checking or capture is on:
+void process_frame_traces() {
+  if (!gVblankArmed) return; // Turned on during this VBLANK, or a reset interrupted it.
+  gVblankArmed = false;
+  fixed_vectors_t now = design_vectors();
+  if (memcmp(&now, &gVblankVectors, sizeof(now)) != 0) {
+    printf("Traces: Skipped this frame, because the vectors changed during VBLANK\n");
+    return;
+  }
+  if (gCheckTraces) {
+    int mismatches = check_traces(gVblankVectors, TB->m_tickcount - gVblankStart, !gLastCheckFailed);
+    ++gCheckedFrames;
+    if (mismatches) ++gMismatchedFrames;
+    gLastCheckFailed = mismatches > 0;
+  }
+  if (gCapture.is_open()) capture_traces(gVblankVectors);
+}
+
+
+
+#ifdef TRACE
+// Called by simulate_refresh() between frames, to check for triggers and move the wave window along:
+void wave_frame_boundary() {
+  // Examine mode hit in the frame that just ended, whereas +wave_frame starts with the next one:
+  if (TB->examine_hit) {
+    TB->examine_hit = false;
+    gWaves.trigger("examine mode", TB->frame_counter);
+  }
+  gWaves.frame_boundary(TB->frame_counter);
+  if (gWaveFrame >= 0 && TB->frame_counter >= gWaveFrame) {
+    gWaveFrame = -1;
+    gWaves.trigger("+wave_frame", TB->frame_counter);
+  }
+}
+#endif
+
+
+
+// Called by simulate_refresh() once the last pixel of line y has been clocked: Does the per-line
+// and per-frame work, and returns true if the refresh should stop here (i.e. to sync up with a line or frame):
+inline bool end_of_line(uint8_t *framebuffer, int y, bool &wrapped) {
+  if (y == V_LOAD_LINE && gPokeInFlight) repoke_vectors();
+  bool traces = gCheckTraces || gCapture.is_open();
+  if (y == VDA-1 && traces) {
+    // That was the last line of the visible area, so vectors are now locked in for the tracer's VBLANK:
+    gVblankVectors = design_vectors();
+    gVblankStart = TB->m_tickcount;
+    gVblankArmed = true;
+  }
+  if (y == VFULL-1) {
+    // ...and of a frame:
+    // if (TB->frame_counter%60 == 0) overflow_test(framebuffer);
+    fade_overflow_region(framebuffer);
+    if (traces) process_frame_traces();
+    if (gVideo.is_open()) gVideo.push(framebuffer, WINDOW_WIDTH*4);
+    if (gProfiler.is_open()) {
+      fixed_vectors_t vec = design_vectors();
+      uint32_t v[6] = { vec.px, vec.py, vec.fx, vec.fy, vec.vx, vec.vy };
+      gProfiler.end_frame(TB->frame_counter, v);
     }
+#ifdef TRACE
+    wave_frame_boundary();
+#endif
+    wrapped = true;
+  }
+  if (gSyncLine) {
+    gSyncLine = false;
+    return true;
+  }
+  if (gSyncFrame && y == VFULL-1) {
+    gSyncFrame = false;
+    return true;
   }
-  for (int x = 0; x < WINDOW_WIDTH; ++x) {
-    for (int y = VFULL; y < WINDOW_HEIGHT; ++y) {
-      fb[(x+y*WINDOW_WIDTH)*4 + 0] = 50;
-      fb[(x+y*WINDOW_WIDTH)*4 + 1] = 150;
-      fb[(x+y*WINDOW_WIDTH)*4 + 2] = 255;
+  return false;
+}
+
+// Scanline kernel for simulate_refresh(): Clock a run of n pixels of one line (starting at
+// whatever h is now, up to the end of the line at most) into row, which points at the first of them.
+// Out of reset, h just counts along with these clocks (one per pixel), so unlike the general
+// per-pixel loop, this doesn't need to read h/v, range-check them, or work out where each pixel goes.
+// Anything that needs a look at every pixel (tracer profiling during VBLANK, USE_SPEAKER) or doesn't
+// have one clock per pixel (DOUBLE_CLOCK) stays with the general loop; see can_capture_span().
+// +check_capture compares the two.
+// Pixels are clocked straight through TB->clock() (no stimulus or vsync work per pixel), in runs up
+// to whichever tick the stimulus next wants to see. That one, and the span's last pixel (where a line
+// ends, and vsync can change), get a full TB->tick_n(1) instead.
+// The span gets clocked first, then packed into the framebuffer, so +metrics can time each on its own.
+//NOTE: It's still one clock per pixel, blanking included: Every clock's output lands in the framebuffer,
+// which shows the whole of HFULL x VFULL (sync markers and all), so there's no stretch to skip.
+inline void capture_span(uint8_t *row, int n, int hilite) {
+  auto *core = TB->m_core;
+  uint8_t line[HFULL]; // Each pixel as: ~hsync, ~vsync, rr, gg, bb (MSB first).
+  {
+    METRICS::SCOPE timer(gMetrics, METRICS::EVAL);
+    int x = 0;
+    while (x < n) {
+      // As per simulate_refresh(): hsync/vsync are for the h/v before this clock; red/green/blue after it.
+      for (int end = x + (int)TB->quiet_clocks(n-1-x); x < end; ++x) {
+        uint8_t syncs = (~core->hsync & 1) << 7 | (~core->vsync & 1) << 6;
+        TB->clock();
+        line[x] = syncs | core->red << 4 | core->green << 2 | core->blue;
+      }
+      uint8_t syncs = (~core->hsync & 1) << 7 | (~core->vsync & 1) << 6;
+      TB->tick_n(1);
+      line[x++] = syncs | core->red << 4 | core->green << 2 | core->blue;
     }
   }
+  METRICS::SCOPE timer(gMetrics, METRICS::FBWRITE);
+  for (int x = 0; x < n; ++x, row += 4) {
+    uint8_t c = line[x];
+    row[2] = (c & 0x30) << 2 | hilite | (c & 0x80);       // R, with hsync.
+    row[1] = (c & 0x0C) << 4 | hilite;                    // G
+    row[0] = (c & 0x03) << 6 | hilite | (c & 0x40) << 1;  // B, with vsync.
+  }
+}
+
+// Whether capture_span() is allowed at all (+check_capture turns it off, to compare with the general loop):
+bool gCaptureSpans = true;
+
+// Whether pixels from here on in line y can go through capture_span():
+inline bool can_capture_span(int y) {
+#if defined(USE_SPEAKER) || defined(DOUBLE_CLOCK)
+  // Speaker output needs a look at every pixel, and with DOUBLE_CLOCK, h doesn't step once per
+  // pixel clock as capture_span() assumes:
+  return false;
+#else
+  //NOTE: Inputs (including reset) only change between refreshes, except for stimulus, which never touches reset.
+  return gCaptureSpans && y < VFULL && !TB->m_core->reset && !(y >= VDA && gProfiler.is_open());
+#endif
 }
 
+// Run the design for up to gRefreshLimit ticks, capturing its video output into the framebuffer.
+// Pixel placement comes straight from vga_sync's h/v counters (exposed as public signals) rather
+// than being inferred from HSYNC/VSYNC edges, so the image is correct from the very first tick,
+// and stays correct across resets. The framebuffer is laid out in the design's own coordinates:
+// (0,0) is the first visible pixel, and blanking (porches and sync) extends right and down to HFULL,VFULL.
+//NOTE: Normally every pixel goes through capture_span(), a line (or what's left of this refresh) at a time.
+// The general per-pixel loop only handles what that can't: Before reset, profiling, speaker, DOUBLE_CLOCK.
+void simulate_refresh(uint8_t *framebuffer) {
+  METRICS::SCOPE timer(gMetrics, METRICS::REFRESH);
+  auto *design = TB->m_core->DESIGN;
+  int hilite = gHighlight ? HILITE : 0; // hilite turns on lower 5 bits to show which pixel(s) have been updated.
+  // Rows written get tracked per refresh (rather than per pixel) so clear_freshness() only has to visit those:
+  int first_y = design->v;
+  int y = first_y;
+  bool wrapped = false;
+
+  for (int i = 0; i < gRefreshLimit; ++i) {
+
+    // red/green/blue are registered, so what comes out after this clock is for the h/v we see
+    // before it. hsync/vsync are combinational from h/v, so likewise sample them now.
+    //NOTE: h/v could be anything up to 1023 prior to the first reset, hence the range check below.
+    int x = design->h;
+    y = design->v;
+
+    if (x < HFULL && can_capture_span(y)) {
+      int n = std::min(HFULL-x, gRefreshLimit-i);
+      capture_span(framebuffer + (y*WINDOW_WIDTH + x)*4, n, hilite);
+      i += n-1;
+      if (x+n == HFULL && end_of_line(framebuffer, y, wrapped)) break;
+      continue;
+    }
+
+    int hsync_bit = TB->m_core->hsync ? 0 : 0b1000'0000;
+    int vsync_bit = TB->m_core->vsync ? 0 : 0b1000'0000;
+    if (y >= VDA && y < VFULL && gProfiler.is_open()) {
+      // The tracer is enabled during VBLANK, so this is the state it's about to act on:
+      gProfiler.sample(design->tracer->state, design->tracer->col_counter);
+    }
 
+    //NOTE: A full tick() (all 3 evals), not tick_n(): This is the reference +check_capture holds capture_span() to.
+    TB->tick();
+#ifdef USE_SPEAKER
+    TB->examine_condition_met |= TB->m_core->speaker;
+#endif // USE_SPEAKER
 
-void render_text(SDL_Renderer* renderer, TTF_Font* font, int x, int y, string s) {
-  SDL_Rect r;
-  SDL_Texture* tex;
-  get_text_and_rect(renderer, x, y, s.c_str(), font, &tex, &r);
-  if (tex) {
-    SDL_RenderCopy(renderer, tex, NULL, &r);
-    SDL_DestroyTexture(tex);
+#ifdef DOUBLE_CLOCK
+    TB->tick();
+#ifdef USE_SPEAKER
+    TB->examine_condition_met |= TB->m_core->speaker;
+#endif // USE_SPEAKER
+    // ^ We tick twice if the design halves the clock to produce the pixel clock.
+#endif // DOUBLE_CLOCK
+
+#ifdef USE_SPEAKER
+    int speaker = (TB->m_core->speaker<<6);
+#else
+    int speaker = 0;
+#endif // USE_SPEAKER
+
+    if (x < HFULL && y < VFULL) {
+      uint8_t *p = framebuffer + (y*WINDOW_WIDTH + x)*4;
+      p[2] = (TB->m_core->red   << 6) | hilite | hsync_bit | speaker;  // R; design drives upper 2 bits of each colour channel.
+      p[1] = (TB->m_core->green << 6) | hilite;                        // G
+      p[0] = (TB->m_core->blue  << 6) | hilite | vsync_bit | speaker;  // B
+    }
+
+    // That was the last pixel of a line:
+    if (x == HFULL-1 && end_of_line(framebuffer, y, wrapped)) break;
+
+  }
+
+  if (hilite) {
+    // If we went past the end of a frame (or v jumped backwards, e.g. due to reset), call it all dirty:
+    if (wrapped || y < first_y) mark_dirty_rows(0, VFULL-1);
+    else                        mark_dirty_rows(first_y, y);
+  }
+}
+
+
+
+// Write the display area (HDA x VDA, starting at h_shift,v_shift) of the framebuffer to a binary PPM file:
+bool write_frame_ppm(const char *filename, const uint8_t *fb, int h_shift = 0, int v_shift = 0) {
+  FILE *f = fopen(filename, "wb");
+  if (!f) {
+    printf("ERROR: Cannot write frame to %s\n", filename);
+    return false;
+  }
+  fprintf(f, "P6\n%d %d\n255\n", HDA, VDA);
+  uint8_t line[HDA*3];
+  for (int y = 0; y < VDA; ++y) {
+    const uint8_t *p = fb + ((y+v_shift)*WINDOW_WIDTH + h_shift)*4;
+    for (int x = 0; x < HDA; ++x, p += 4) {
+      // Framebuffer is BGRA:
+      line[x*3+0] = p[2];
+      line[x*3+1] = p[1];
+      line[x*3+2] = p[0];
+    }
+    fwrite(line, sizeof(line), 1, f);
+  }
+  fclose(f);
+  return true;
+}
+
+
+
+// Checkpoint file: Verilator's own save header, then checkpoint_header_t, the framebuffer,
+// and finally the model itself. Coroutine stimulus (e.g. an SPI frame going out) can't be saved,
+// so a save waits until there is none. Restoring needs the exact same sim build that saved it.
+#define CHECKPOINT_MAGIC    "RBCHKPT\x1A"
+#define CHECKPOINT_VERSION  1
+
+typedef struct {
+  char            magic[8];         // CHECKPOINT_MAGIC
+  uint32_t        version;          // CHECKPOINT_VERSION
+  uint32_t        framebuffer_size; // FRAMEBUFFER_SIZE
+  uint64_t        tickcount;        // TB->m_tickcount
+  int32_t         frame_counter;    // TB->frame_counter
+  uint8_t         old_hsync, old_vsync;
+  uint8_t         override_vectors; // gOverrideVectors
+  uint8_t         spi_backdoor;     // gSpiBackdoor
+  int32_t         refresh_limit;    // gRefreshLimit
+  uint8_t         sync_line;        // gSyncLine
+  uint8_t         sync_frame;       // gSyncFrame
+  uint8_t         spare[2];
+  float_vectors_t overs;            // gOvers
+} checkpoint_header_t;
+
+bool save_checkpoint(const char *filename, const uint8_t *framebuffer) {
+#ifdef SAVABLE
+  if (TB->stimulus.running()) {
+    printf("ERROR: Cannot save a checkpoint while stimulus is running\n");
+    return false;
+  }
+  checkpoint_header_t h = {};
+  memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+  h.version           = CHECKPOINT_VERSION;
+  h.framebuffer_size  = FRAMEBUFFER_SIZE;
+  h.tickcount         = TB->m_tickcount;
+  h.frame_counter     = TB->frame_counter;
+  h.old_hsync         = TB->old_hsync;
+  h.old_vsync         = TB->old_vsync;
+  h.override_vectors  = gOverrideVectors;
+  h.spi_backdoor      = gSpiBackdoor;
+  h.refresh_limit     = gRefreshLimit;
+  h.sync_line         = gSyncLine;
+  h.sync_frame        = gSyncFrame;
+  h.overs             = gOvers;
+  VerilatedSave os;
+  os.open(filename);
+  if (!os.isOpen()) {
+    printf("ERROR: Cannot write checkpoint %s\n", filename);
+    return false;
+  }
+  os.write(&h, sizeof(h));
+  os.write(framebuffer, FRAMEBUFFER_SIZE);
+  os << *TB->m_core;
+  os.close();
+  printf("Saved checkpoint %s at tick %lu (frame %d)\n", filename, TB->m_tickcount, TB->frame_counter);
+  return true;
+#else
+  printf("ERROR: Checkpoints need a SAVABLE (i.e. --savable) build of the sim\n");
+  return false;
+#endif
+}
+
+bool restore_checkpoint(const char *filename, uint8_t *framebuffer) {
+#ifdef SAVABLE
+  if (TB->stimulus.running()) {
+    printf("ERROR: Cannot restore a checkpoint while stimulus is running\n");
+    return false;
+  }
+  VerilatedRestore is;
+  is.open(filename);
+  if (!is.isOpen()) {
+    printf("ERROR: Cannot read checkpoint %s\n", filename);
+    return false;
+  }
+  checkpoint_header_t h;
+  is.read(&h, sizeof(h));
+  if (memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) || h.version != CHECKPOINT_VERSION || h.framebuffer_size != FRAMEBUFFER_SIZE) {
+    printf("ERROR: %s is not a checkpoint from this sim\n", filename);
+    return false;
+  }
+  is.read(framebuffer, FRAMEBUFFER_SIZE);
+  is >> *TB->m_core;
+  is.close();
+  TB->m_tickcount     = h.tickcount;
+  TB->frame_counter   = h.frame_counter;
+  TB->old_hsync       = h.old_hsync;
+  TB->old_vsync       = h.old_vsync;
+  gOverrideVectors    = h.override_vectors;
+  gSpiBackdoor        = h.spi_backdoor;
+  gRefreshLimit       = h.refresh_limit;
+  gSyncLine           = h.sync_line;
+  gSyncFrame          = h.sync_frame;
+  gOvers              = h.overs;
+  // Whatever the harness was in the middle of no longer applies:
+  gSpi->forget_sent();
+  gPokeInFlight = false;
+  gVblankArmed = false;
+  gProfiler.discard_frame();
+  gMetrics.rebase(TB->m_tickcount, TB->frame_counter);
+  mark_dirty_rows(0, VFULL-1);
+  printf("Restored checkpoint %s at tick %lu (frame %d)\n", filename, TB->m_tickcount, TB->frame_counter);
+  return true;
+#else
+  printf("ERROR: Checkpoints need a SAVABLE (i.e. --savable) build of the sim\n");
+  return false;
+#endif
+}
+
+// SIMULATION thread: Carry out any checkpoint save or restore that K/Shift+K asked for:
+void service_checkpoints(uint8_t *framebuffer) {
+  if (TB->stimulus.running()) return; // Try again after the next refresh.
+  if (gSaveCheckpoint) {
+    gSaveCheckpoint = false;
+    save_checkpoint(gCheckpointFile.c_str(), framebuffer);
+  }
+  if (gRestoreCheckpoint) {
+    gRestoreCheckpoint = false;
+    restore_checkpoint(gCheckpointFile.c_str(), framebuffer);
+  }
+}
+
+
+
+// Peak resident set size of the whole process so far, in KiB (0 where it can't be had):
+long peak_rss_kb() {
+#ifdef _WIN32
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  #ifdef __APPLE__
+  return usage.ru_maxrss / 1024; // macOS gives bytes; Linux gives KiB.
+  #else
+  return usage.ru_maxrss;
+  #endif
+#endif
+}
+
+
+
+// Headless mode: Never touches the SDL window, renderer, or fonts. Instead, it runs
+// a fixed number of frames and writes captured frames out to PPM files.
+// Options (plusargs):
+//  +headless         Turns this mode on.
+//  +frames=N         Number of frames to run (default 1).
+//  +pose=N           Load gTestVectors pose N (1..10, as per F1..F10) after reset.
+//  +pose=px,py,fx,fy,vx,vy  Or load these vectors (as decimals, e.g. +pose=2.5,12.5,1,0,0,0.66).
+//  +dump_every=N     Write every Nth frame; 0 (default) means write only the final frame.
+//  +dump_prefix=P    Prefix for frame files (default "sim_frame"), written as P_NNNNNN.ppm
+//  +no_dump          Don't write any frames at all; just measure throughput.
+//  +check            Check every frame's traces against TRACER_MODEL; exit non-zero on any mismatch.
+//  +check_poses      Instead of the above, run one frame of each F1..F10 pose and check its traces.
+//  +check_capture    Instead, check that span capture (capture_span()) matches the general per-pixel loop.
+//  +restore=FILE     Start from a checkpoint instead of a reset (SAVABLE builds only).
+//  +checkpoint_at=N  Save a checkpoint (to +checkpoint=FILE) after frame N.
+
+// Pose to load after the initial reset: 1..10 (gTestVectors), POSE_VECTORS (explicit vectors, which go
+// in gPoseVectors), or 0 for none. As per +pose, or else whatever the input log being replayed started with:
+#define POSE_VECTORS  -1
+#define POSE_INVALID  -2
+uint32_t gPoseVectors[6];
+
+int start_pose() {
+  string value;
+  if (!get_plusarg("pose", value)) return gPlayer.start_vectors(gPoseVectors) ? POSE_VECTORS : gPlayer.start_pose();
+  if (value.find(',') == string::npos) return atoi(value.c_str());
+  double d[6];
+  int used = 0;
+  if (6 != sscanf(value.c_str(), "%lf,%lf,%lf,%lf,%lf,%lf%n", &d[0], &d[1], &d[2], &d[3], &d[4], &d[5], &used) || value[used]) {
+    printf("ERROR: +pose needs N (1..10) or px,py,fx,fy,vx,vy, not: %s\n", value.c_str());
+    return POSE_INVALID;
+  }
+  for (int i = 0; i < 6; ++i) gPoseVectors[i] = double2fixed(d[i]);
+  return POSE_VECTORS;
+}
+
+// Reset the design, and get it to where its first real frame is about to start: Optionally with
+// one of gTestVectors (pose 1..10) or gPoseVectors (POSE_VECTORS), and refreshes lined up with
+// whole frames from then on.
+void start_from_reset(uint8_t *framebuffer, int pose) {
+  gRefreshLimit = REFRESH_FRAME;
+  TB->m_core->show_debug = 1;
+  TB->reset();
+  if (pose >= 1 && pose <= 10) {
+    load_test_vectors(pose-1);
+  } else if (pose == POSE_VECTORS) {
+    poke_vectors(gPoseVectors);
+  } else {
+    // Without SPI input, the design would otherwise pick up junk vectors at the end of the first frame:
+    hold_current_vectors();
+  }
+
+  // The tracer fills the trace buffer during VBLANK, so the first frame after reset shows
+  // whatever junk was in it. Run that frame out first, so every counted frame is a real one:
+  gSyncFrame = true;
+  gVideo.skip(true);
+  simulate_refresh(framebuffer);
+  gVideo.skip(false);
+}
+
+// Headless +check_poses: Load each of gTestVectors in turn, and check the traces of one frame of each.
+int run_pose_checks(uint8_t *framebuffer) {
+  int failed = 0;
+  gCheckTraces = true;
+  for (int n = 0; n < 10; ++n) {
+    int checked = gCheckedFrames;
+    int mismatched = gMismatchedFrames;
+    gLastCheckFailed = false; // Every pose gets its own full report.
+    printf("Pose F%d:\n", n+1);
+    load_test_vectors(n);
+    simulate_refresh(framebuffer);
+    bool ok = gCheckedFrames > checked && gMismatchedFrames == mismatched;
+    if (!ok) ++failed;
+    printf("Pose F%d: %s\n", n+1, ok ? "OK" : (gCheckedFrames > checked ? "MISMATCH" : "NOT CHECKED"));
+  }
+  printf("CHECK: poses=10 failed=%d\n", failed);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Run one whole frame (from the start of one) as refreshes of refresh_limit ticks each:
+void simulate_frame_in(uint8_t *framebuffer, int refresh_limit) {
+  int old_limit = gRefreshLimit;
+  gRefreshLimit = refresh_limit;
+  for (int n = 0; n < REFRESH_FRAME; n += refresh_limit) simulate_refresh(framebuffer);
+  gRefreshLimit = old_limit;
+}
+
+// Headless +check_capture: For each of gTestVectors, capture one frame in REFRESH_PIXEL mode through the
+// general loop (i.e. with capture_span() off), and then one each in REFRESH_LINE and REFRESH_FASTPIXEL modes
+// (through capture_span(), as whole and partial lines), and check the framebuffer comes out the same.
+// The pose is held still, so all of the frames should be identical.
+int run_capture_checks(uint8_t *framebuffer) {
+  uint8_t *pixel_fb = new uint8_t[FRAMEBUFFER_SIZE];
+  int failed = 0;
+  for (int n = 0; n < 10; ++n) {
+    load_test_vectors(n);
+    simulate_refresh(framebuffer); // Let the pose take effect (the design latches vectors at the end of a frame).
+    gCaptureSpans = false;
+    simulate_frame_in(framebuffer, REFRESH_PIXEL);
+    gCaptureSpans = true;
+    memcpy(pixel_fb, framebuffer, FRAMEBUFFER_SIZE);
+    int diffs = 0;
+    for (int limit : { REFRESH_LINE, REFRESH_FASTPIXEL }) {
+      simulate_frame_in(framebuffer, limit);
+      for (int y = 0; y < VFULL; ++y) {
+        for (int x = 0; x < HFULL; ++x) {
+          int i = (y*WINDOW_WIDTH + x)*4;
+          if (memcmp(pixel_fb+i, framebuffer+i, 3)) {
+            if (!diffs) printf("  First difference at (%d,%d), refreshing every %d pixel(s)\n", x, y, limit);
+            ++diffs;
+          }
+        }
+      }
+    }
+    if (diffs) ++failed;
+    printf("Pose F%d capture: %s", n+1, diffs ? "MISMATCH" : "OK");
+    if (diffs) printf(" (%d pixel(s) differ)", diffs);
+    printf("\n");
+  }
+  delete [] pixel_fb;
+  printf("CAPTURE CHECK: poses=10 failed=%d\n", failed);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Headless +check_spi: Send each of gTestVectors in turn over SPI alone (i.e. without also poking
+// them into the design), then check that the design has loaded them by the VSYNC after next:
+stim_task spi_pose_checks(int *failed) {
+  for (int n = 0; n < 10; ++n) {
+    uint32_t *v = gTestVectors[n];
+    uint64_t start = TB->m_tickcount;
+    gSpi->send(v);
+    while (gSpi->busy()) co_await ticks(16);
+    unsigned long spi_ticks = TB->m_tickcount - start;
+    // The design loads ready_buffer at the end of the visible area, which might have already passed in this frame:
+    co_await vsync();
+    co_await vsync();
+    fixed_vectors_t got = design_vectors();
+    bool ok =
+      got.px == v[0] && got.py == v[1] && got.fx == v[2] &&
+      got.fy == v[3] && got.vx == v[4] && got.vy == v[5];
+    if (!ok) {
+      ++*failed;
+      printf("  Sent:     { 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X }\n", v[0], v[1], v[2], v[3], v[4], v[5]);
+      printf("  Design:   { 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X }\n", got.px, got.py, got.fx, got.fy, got.vx, got.vy);
+    }
+    printf("Pose F%d over SPI (%lu ticks): %s\n", n+1, spi_ticks, ok ? "OK" : "MISMATCH");
+  }
+}
+
+int run_spi_checks(uint8_t *framebuffer) {
+  int failed = 0;
+  TB->stimulus.spawn(spi_pose_checks(&failed));
+  // Each pose needs at most 3 frames, but don't hang if the design never gets there:
+  for (int frame = 0; TB->stimulus.running() && frame < 40; ++frame) simulate_refresh(framebuffer);
+  if (TB->stimulus.running()) {
+    printf("ERROR: SPI checks didn't finish\n");
+    return EXIT_FAILURE;
+  }
+  printf("SPI CHECK: poses=10 failed=%d\n", failed);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int run_headless(uint8_t *framebuffer) {
+  int frames      = get_plusarg_int("frames", 1);
+  int pose        = start_pose();
+  int dump_every  = get_plusarg_int("dump_every", 0);
+  bool no_dump    = has_plusarg("no_dump");
+  string dump_prefix = "sim_frame";
+  get_plusarg("dump_prefix", dump_prefix);
+
+  // A replay runs for exactly as long as its input log says:
+  if (gPlayer.loaded()) frames = gPlayer.end();
+
+  printf("Headless mode: %d frame(s)", frames);
+  if (pose == POSE_VECTORS) {
+    printf(" from pose (%g, %g) facing (%g, %g) vplane (%g, %g)",
+      fixed2double(gPoseVectors[0]), fixed2double(gPoseVectors[1]), fixed2double(gPoseVectors[2]),
+      fixed2double(gPoseVectors[3]), fixed2double(gPoseVectors[4]), fixed2double(gPoseVectors[5]));
+  } else if (pose) {
+    printf(" from pose F%d", pose);
+  }
+  if (gPlayer.loaded()) printf(", replaying inputs");
+  printf("\n");
+
+  gHighlight = false; // Don't tint captured frames.
+  if (gRestoreFile.empty()) {
+    start_from_reset(framebuffer, pose);
+  } else if (!restore_checkpoint(gRestoreFile.c_str(), framebuffer)) {
+    return EXIT_FAILURE;
+  }
+  int checkpoint_at = get_plusarg_int("checkpoint_at", 0);
+
+  if (has_plusarg("check_poses")) return run_pose_checks(framebuffer);
+  if (has_plusarg("check_spi")) return run_spi_checks(framebuffer);
+  if (has_plusarg("check_capture")) return run_capture_checks(framebuffer);
+  gCheckTraces = has_plusarg("check");
+
+  auto start_time = chrono::steady_clock::now();
+  unsigned long start_ticks = TB->m_tickcount;
+  int frame = 0;
+  int dumped = 0;
+
+  while (!TB->done() && frame < frames) {
+    if (gPlayer.loaded()) {
+      int old_reset = TB->m_core->reset;
+      if (!replay_inputs()) break;
+      if (old_reset != TB->m_core->reset) resync_refresh();
+    }
+    reload_assets(false);
+    simulate_refresh(framebuffer);
+    gMetrics.write(TB->m_tickcount, TB->frame_counter);
+    ++frame;
+    if (frame == checkpoint_at && !save_checkpoint(gCheckpointFile.c_str(), framebuffer)) return EXIT_FAILURE;
+    bool last = (frame >= frames) || TB->done();
+    if (!no_dump && (last || (dump_every > 0 && frame % dump_every == 0))) {
+      char filename[1024];
+      snprintf(filename, sizeof(filename), "%s_%06d.ppm", dump_prefix.c_str(), frame);
+      if (write_frame_ppm(filename, framebuffer)) ++dumped;
+    }
+  }
+
+  gMetrics.write(TB->m_tickcount, TB->frame_counter, true); // Whatever's left of the last interval.
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+  unsigned long ticks = TB->m_tickcount - start_ticks;
+  long hz = elapsed > 0 ? long(ticks / elapsed) : 0;
+  printf("Headless run done: %d frame(s), %d file(s) written, %.3f s, m_tickcount=", frame, dumped, elapsed);
+  TB->print_big_num(TB->m_tickcount);
+  printf(" (");
+  TB->print_big_num(hz);
+  printf(" Hz; %3ld%% of target)\n", (hz*100)/CLOCK_HZ);
+  // Same again, but in a form that's easy for scripts to pick up:
+  printf(
+    "RESULT: frames=%d ticks=%lu seconds=%.6f hz=%ld target_hz=%d peak_rss_kb=%ld\n",
+    frame, ticks, elapsed, hz, CLOCK_HZ, peak_rss_kb()
+  );
+  if (gCheckTraces) {
+    printf("CHECK: frames=%d mismatched=%d\n", gCheckedFrames, gMismatchedFrames);
+    if (gMismatchedFrames || !gCheckedFrames) return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+
+
+// SIMULATION thread: Hand the current state of the framebuffer (plus everything the HUD needs)
+// over to the main thread for presentation:
+void publish_frame(FRAME_EXCHANGE<sim_frame_t> *frames, const uint8_t *framebuffer) {
+  sim_frame_t *frame = frames->back();
+  {
+    METRICS::SCOPE timer(gMetrics, METRICS::PUBLISH);
+    memcpy(frame->pixels, framebuffer, FRAMEBUFFER_SIZE);
+  }
+  {
+    METRICS::SCOPE timer(gMetrics, METRICS::OVERLAY);
+    overlay_display_area_frame(frame->pixels);
+  }
+  frame->vectors = design_vectors();
+  frame->overs            = gOvers;
+  frame->paused           = TB->paused;
+  frame->guides           = gGuides;
+  frame->highlight        = gHighlight;
+  frame->log_vsync        = TB->log_vsync;
+  frame->override_vectors = gOverrideVectors;
+  frame->examine_mode     = TB->examine_mode;
+  memcpy(frame->locks, gLockInputs, sizeof(gLockInputs));
+  frames->publish();
+}
+
+
+
+// SIMULATION thread: Run the design continuously, publishing frames for the main thread.
+//NOTE: A new frame is only published once the main thread has taken the previous one,
+// so the copying that involves is limited to the display rate, rather than every refresh.
+// Between publishes, refreshes just keep accumulating in the framebuffer (and in the
+// "freshness" highlighting of what has changed since the last published frame).
+void run_simulation(FRAME_EXCHANGE<sim_frame_t> *frames, uint8_t *framebuffer) {
+  gMetrics.console(true, CLOCK_HZ);
+  gMetrics.rebase(TB->m_tickcount, TB->frame_counter); // Used for measuring simulated clock speed.
+
+  while (!gQuit) {
+    if (TB->done()) gQuit = true;
+    if (TB->paused) {
+      // Make sure the frame we paused on gets shown, then wait for an event, as one is needed before we could resume:
+      publish_frame(frames, framebuffer);
+      wait_for_input();
+    }
+
+    handle_control_inputs(true); // true = PREPARE mode; set default signal inputs, so process_sdl_events can OPTIONALLY override.
+    //SMELL: Should we do handle_control_inputs(true) only when we detect the start of a new frame,
+    // so as to preserve/capture any keys that were pressed across *partial* refreshes?
+    process_sdl_events();
+    if (gQuit) break;
+    if (TB->paused) {
+      // Keep the HUD up to date with whatever the events changed while paused:
+      publish_frame(frames, framebuffer);
+      continue;
+    }
+
+    int old_reset = TB->m_core->reset;
+    handle_control_inputs(false); // false = ACTIVE mode; add in actual HID=>signal input changes.
+    if (old_reset != TB->m_core->reset) {
+      // Reset state changed, so line up refreshes with the design's scan position again:
+      resync_refresh();
+      gProfiler.discard_frame();
+    }
+
+    gMetrics.write(TB->m_tickcount, TB->frame_counter);
+    reload_assets(false);
+    service_checkpoints(framebuffer);
+
+    simulate_refresh(framebuffer);
+
+    if (frames->consumed()) {
+      publish_frame(frames, framebuffer);
+      METRICS::SCOPE timer(gMetrics, METRICS::OVERLAY);
+      clear_freshness(framebuffer);
+    }
+  }
+  quit_simulation(); // In case it was us (not the main thread) that decided to quit.
+}
+
+
+
+// HUD text, drawn from gGlyphs (if the font loaded). Each field only gets formatted and laid out again
+// when the value it shows actually changes. These all belong to the main thread:
+GLYPH_ATLAS   gGlyphs;
+GLYPH_TEXT    gHudFlags;
+GLYPH_TEXT    gHudPlayer;
+GLYPH_TEXT    gHudFacing;
+GLYPH_TEXT    gHudVplane;
+GLYPH_TEXT    gHudCell;
+
+// Key for GLYPH_TEXT::stale() from a pair of 24-bit fixed-point values:
+uint64_t fixed_pair_key(uint32_t a, uint32_t b) {
+  return (uint64_t(a) << 32) | b;
+}
+
+string fixed_pair_text(const char *label, uint32_t a, uint32_t b) {
+  return string(" ") + label + "=(" + to_string(fixed2double(a)) + ", " + to_string(fixed2double(b)) + ") ";
+}
+
+// MAIN thread: Draw the HUD text and guides for a frame, from its snapshot of the sim's state:
+void render_hud(SDL_Renderer *renderer, const sim_frame_t *frame) {
+  if (gGlyphs.valid()) {
+    // Show the state of controls that can be toggled:
+    bool flags[] = {
+      frame->paused,            frame->guides,          frame->highlight,       frame->log_vsync,
+      frame->override_vectors,  frame->examine_mode,    frame->locks[LOCK_MAP], frame->locks[LOCK_L],
+      frame->locks[LOCK_F],     frame->locks[LOCK_B],   frame->locks[LOCK_R],   gMouseCapture
+    };
+    const char *flag_chars = "PGHVOXm<^v>*";
+    uint64_t flags_key = 0;
+    for (size_t i = 0; i < std::size(flags); ++i) flags_key |= uint64_t(flags[i]) << i;
+    if (gHudFlags.stale(flags_key)) {
+      string s = "[";
+      for (size_t i = 0; i < std::size(flags); ++i) s += flags[i] ? flag_chars[i] : '.';
+#ifdef INSPECT_INTERNAL
+      s += "] ";
+#endif
+      gHudFlags.set(gGlyphs, s);
+    }
+    int x = 10;
+    int y = VFULL+10;
+    x += gHudFlags.draw(renderer, gGlyphs, x, y);
+#ifdef INSPECT_INTERNAL
+    // Player position:
+    if (gHudPlayer.stale(fixed_pair_key(frame->vectors.px, frame->vectors.py))) {
+      gHudPlayer.set(gGlyphs, fixed_pair_text("pX,Y", frame->vectors.px, frame->vectors.py));
+    }
+    x += gHudPlayer.draw(renderer, gGlyphs, x, y);
+    if (gHudFacing.stale(fixed_pair_key(frame->vectors.fx, frame->vectors.fy))) {
+      gHudFacing.set(gGlyphs, fixed_pair_text("fX,Y", frame->vectors.fx, frame->vectors.fy));
+    }
+    x += gHudFacing.draw(renderer, gGlyphs, x, y);
+    if (gHudVplane.stale(fixed_pair_key(frame->vectors.vx, frame->vectors.vy))) {
+      gHudVplane.set(gGlyphs, fixed_pair_text("vX,Y", frame->vectors.vx, frame->vectors.vy));
+    }
+    x += gHudVplane.draw(renderer, gGlyphs, x, y);
+#endif
+  }
+  if (frame->guides) {
+    int ox = HDA/2;
+    int oy = VDA/2;
+    double s = VDA/4;
+    //SMELL: Add in grid-cell alignment too.
+    // Draw the design's current vectors in green:
+    SDL_SetRenderDrawColor(renderer, 0,255,0,255);
+    double fx = fixed2double(frame->vectors.fx);
+    double fy = fixed2double(frame->vectors.fy);
+    double vx = fixed2double(frame->vectors.vx);
+    double vy = fixed2double(frame->vectors.vy);
+    int lx = ox+(fx-vx)*s;
+    int ly = oy+(fy-vy)*s;
+    int rx = ox+(fx+vx)*s;
+    int ry = oy+(fy+vy)*s;
+    // Draw center directional line:
+    SDL_RenderDrawLine(renderer, ox, oy, ox+fx*s, oy+fy*s);
+    // Draw left camera vector:
+    SDL_RenderDrawLine(renderer, ox, oy, lx, ly);
+    // Draw right camera vector:
+    SDL_RenderDrawLine(renderer, ox, oy, rx, ry);
+    // Draw viewplane:
+    SDL_RenderDrawLine(renderer, lx, ly, rx, ry);
+    // Draw the box representing the position of the player in the current cell,
+    // i.e. just draw a unit square offset by the fractional part of the player position:
+    double px  = fixed2double(frame->vectors.px,  1); // Integer part.
+    double py  = fixed2double(frame->vectors.py,  1); // Integer part.
+    double pxf = fixed2double(frame->vectors.px, -1); // Fractional part.
+    double pyf = fixed2double(frame->vectors.py, -1); // Fractional part.
+    SDL_Rect r;
+    r.x = ox-pxf*s;
+    r.y = oy-pyf*s;
+    r.w = r.h = s;
+    SDL_RenderDrawRect(renderer, &r);
+    if (gGlyphs.valid()) {
+      if (gHudCell.stale(fixed_pair_key(int(px), int(py)))) {
+        gHudCell.set(gGlyphs, to_string(int(px)) + ", " + to_string(int(py)));
+      }
+      gHudCell.draw(renderer, gGlyphs, r.x+3, r.y+s-14);
+    }
+    if (frame->override_vectors) {
+      // Now draw sim's overriding vectors over them, in white:
+      SDL_SetRenderDrawColor(renderer, 255,255,255,255);
+      lx = ox+(frame->overs.fx-frame->overs.vx)*s;
+      ly = oy+(frame->overs.fy-frame->overs.vy)*s;
+      rx = ox+(frame->overs.fx+frame->overs.vx)*s;
+      ry = oy+(frame->overs.fy+frame->overs.vy)*s;
+      // Draw center directional line:
+      SDL_RenderDrawLine(renderer, ox, oy, ox+frame->overs.fx*VDA/4, oy+frame->overs.fy*VDA/4);
+      // Draw left camera vector:
+      SDL_RenderDrawLine(renderer, ox, oy, lx, ly);
+      // Draw right camera vector:
+      SDL_RenderDrawLine(renderer, ox, oy, rx, ry);
+      // Draw viewplane:
+      SDL_RenderDrawLine(renderer, lx, ly, rx, ry);
+      // Draw box:
+      px = frame->overs.px;
+      py = frame->overs.py;
+      double dummy;
+      pxf = modf(px, &dummy);
+      pyf = modf(py, &dummy);
+      // Fix negative partials: //SMELL: Why is this necessary?
+      if (pxf < 0) pxf = pxf+1;
+      if (pyf < 0) pyf = pyf+1;
+      r.x = ox-pxf*s;
+      r.y = oy-pyf*s;
+      r.w = r.h = s;
+      SDL_RenderDrawRect(renderer, &r);
+    }
   }
 }
 
@@ -1004,6 +2165,11 @@ void render_text(SDL_Renderer* renderer, TTF_Font* font, int x, int y, string s)
 
 int main(int argc, char **argv) {
 
+  // +video=- streams video to stdout, so from the very start, anything else for stdout goes to stderr instead:
+  for (int i = 1; i < argc; ++i) {
+    if (0 == strcmp(argv[i], "+video=-")) VIDEO_WRITER::claim_stdout();
+  }
+
   printf("DEBUG: main() command-line arguments:\n");
   for (int i = 0; i < argc; ++i) {
     printf("%d: [%s]\n", i, argv[i]);
@@ -1013,6 +2179,8 @@ int main(int argc, char **argv) {
   // Verilated::traceEverOn(true);
   
   TB = new MAIN_TB();
+  gSpi = new SPI_MASTER<VDESIGN>(TB->stimulus, TB->m_core);
+  gSpiBackdoor = has_plusarg("spi_backdoor");
 #ifdef USE_POWER_PINS
   #pragma message "Howdy! This simulation build has USE_POWER_PINS in effect"
   TB->m_core->VGND = 0;
@@ -1022,6 +2190,89 @@ int main(int argc, char **argv) {
 #endif
   uint8_t *framebuffer = new uint8_t[FRAMEBUFFER_SIZE];
 
+  string capture_file;
+  if (get_plusarg("capture", capture_file)) {
+    if (!gCapture.open(capture_file.c_str())) return EXIT_FAILURE;
+    printf("Capturing traces to %s\n", capture_file.c_str());
+  }
+  string profile_prefix;
+  if (get_plusarg("profile", profile_prefix)) {
+    if (!gProfiler.open(profile_prefix.c_str())) return EXIT_FAILURE;
+    printf("Profiling tracer to %s_frames.csv, %s_columns.csv and %s_histograms.csv\n", profile_prefix.c_str(), profile_prefix.c_str(), profile_prefix.c_str());
+  }
+  if (!init_assets()) return EXIT_FAILURE;
+  string replay_file;
+  if (get_plusarg("replay", replay_file)) {
+    if (!gPlayer.load(replay_file.c_str())) return EXIT_FAILURE;
+    printf("Replaying %lu frame(s) of inputs from %s\n", gPlayer.end(), replay_file.c_str());
+  }
+  int pose = start_pose();
+  if (pose == POSE_INVALID) return EXIT_FAILURE;
+  string record_file;
+  if (get_plusarg("record", record_file)) {
+    bool vectors = pose == POSE_VECTORS;
+    if (!gRecorder.open(record_file.c_str(), vectors ? 0 : pose, vectors ? gPoseVectors : NULL)) return EXIT_FAILURE;
+    printf("Recording inputs to %s\n", record_file.c_str());
+  }
+
+#ifdef TRACE
+  string wave_prefix = "waves";
+  bool wave_armed = get_plusarg("wave", wave_prefix);
+  #ifdef TRACE_FST
+  const char *wave_ext = "fst";
+  #else
+  const char *wave_ext = "vcd";
+  #endif
+  gWaves.init(TB, wave_prefix, wave_ext, get_plusarg_int("wave_pre", 2), get_plusarg_int("wave_post", 2));
+  gWaveFrame = get_plusarg_int("wave_frame", -1);
+  if (wave_armed) gWaves.arm(true, TB->frame_counter);
+#else
+  if (has_plusarg("wave")) printf("WARNING: +wave needs a TRACE build of the sim, e.g. make sim_fst\n");
+#endif
+  string metrics_file;
+  if (get_plusarg("metrics", metrics_file)) {
+    int interval = get_plusarg_int("metrics_interval", 1000);
+    if (!gMetrics.open(metrics_file.c_str(), interval)) return EXIT_FAILURE;
+    printf("Writing metrics to %s every %d ms\n", metrics_file.c_str(), interval);
+  }
+  get_plusarg("checkpoint", gCheckpointFile);
+  if (get_plusarg("restore", gRestoreFile) && (gRecorder.is_open() || gPlayer.loaded())) {
+    printf("ERROR: +record and +replay start from a reset, so can't be used with +restore\n");
+    return EXIT_FAILURE;
+  }
+
+  gHeadless = has_plusarg("headless");
+  string video_file;
+  if (get_plusarg("video", video_file)) {
+    int format = VIDEO_WRITER::format_for(video_file.c_str());
+    string format_name;
+    if (get_plusarg("video_format", format_name)) {
+      format = format_name == "y4m" ? VIDEO_WRITER::Y4M : format_name == "ppm" ? VIDEO_WRITER::PPM : VIDEO_WRITER::RGB;
+    }
+#ifdef DOUBLE_CLOCK
+    int frame_ticks = REFRESH_FRAME*2;
+#else
+    int frame_ticks = REFRESH_FRAME;
+#endif
+    // Headless runs wait for the writer rather than drop frames; windowed mode keeps going and drops them:
+    if (!gVideo.open(video_file.c_str(), format, HDA, VDA, CLOCK_HZ, frame_ticks, get_plusarg_int("video_queue", 16), gHeadless)) return EXIT_FAILURE;
+    printf("Streaming video to %s\n", video_file.c_str());
+  }
+  if (gHeadless) {
+    int result = run_headless(framebuffer);
+    gVideo.close();
+    close_capture();
+#ifdef TRACE
+    gWaves.close();
+#endif
+    gProfiler.close();
+    gMetrics.close();
+    close_recording();
+    delete [] framebuffer;
+    printf("Done at %lu ticks.\n", TB->m_tickcount);
+    return result;
+  }
+
   //SMELL: This needs proper error handling!
   printf("SDL_InitSubSystem(SDL_INIT_VIDEO): %d\n", SDL_InitSubSystem(SDL_INIT_VIDEO));
 
@@ -1036,7 +2287,7 @@ int main(int argc, char **argv) {
       SDL_CreateRenderer(
           window,
           -1,
-          SDL_RENDERER_ACCELERATED
+          SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC
       );
 
   toggle_mouse_capture(true, gMouseCapture); // Dummy "toggle" to just set current mode, in order to print it.
@@ -1044,7 +2295,7 @@ int main(int argc, char **argv) {
   TTF_Init();
   TTF_Font *font = TTF_OpenFont(FONT_FILE, 12);
   if (!font) {
-#if __cplusplus == 201703L
+#if __cplusplus >= 201703L
     std::filesystem::path font_path = std::filesystem::absolute(FONT_FILE);
 #else
     string font_path = FONT_FILE;
@@ -1057,6 +2308,8 @@ int main(int argc, char **argv) {
   }
   else {
     printf("Font loaded.\n");
+    // All HUD text is drawn from this, rather than rendering text with TTF every frame:
+    if (gGlyphs.build(renderer, font)) printf("Glyph atlas built.\n");
   }
 
   //SMELL: This isn't actually used anymore because now the ROM data is embedded in the Verilog:
@@ -1102,279 +2355,62 @@ int main(int argc, char **argv) {
   // }
   printf("Cold start...\n");
 
-  int h = 0;
-  int v = 0;
-
   printf("Main loop...\n");
 
-  gOriginalTime = gPrevTime = SDL_GetTicks();
-  gPrevTickCount = TB->m_tickcount; // Used for measuring simulated clock speed.
-  gPrevFrames = 0;
+  // The simulation gets its own thread, so it never waits on SDL (e.g. for vsync or the compositor).
+  // This thread just presents whatever is the latest frame it has published:
+  if (gRecorder.is_open() || gPlayer.loaded()) {
+    // Recording and replay both need to start from the same known state:
+    start_from_reset(framebuffer, start_pose());
+  } else if (!gRestoreFile.empty() && !restore_checkpoint(gRestoreFile.c_str(), framebuffer)) {
+    return EXIT_FAILURE;
+  }
 
-  bool count_hbp = false;
-  int hbp_counter = 0; // Counter for timing the HBP (i.e. time after HSP, but before HDA).
-  int h_adjust = HBP*2; // Amount to count in hbp_counter. Start at a high value and then sync back down.
-  int h_adjust_countdown = REFRESH_FRAME*2;
-  int v_shift = VBP*2; // This will try to find the vertical start of the image.
+  FRAME_EXCHANGE<sim_frame_t> *frames = new FRAME_EXCHANGE<sim_frame_t>;
+  thread sim_thread(run_simulation, frames, framebuffer);
 
   while (!gQuit) {
-    if (TB->done()) gQuit = true;
-    if (TB->paused) SDL_WaitEvent(NULL); // If we're paused, an event is needed before we could resume.
-
-    handle_control_inputs(true); // true = PREPARE mode; set default signal inputs, so process_sdl_events can OPTIONALLY override.
-    //SMELL: Should we do handle_control_inputs(true) only when we detect the start of a new frame,
-    // so as to preserve/capture any keys that were pressed across *partial* refreshes?
-    process_sdl_events();
-    if (gQuit) break;
-    if (TB->paused) continue;
-
-    int old_reset = TB->m_core->reset;
-    handle_control_inputs(false); // false = ACTIVE mode; add in actual HID=>signal input changes.
-    if (old_reset != TB->m_core->reset) {
-      // Reset state changed, so we probably need to resync:
-      h_adjust = HBP*2;
-      count_hbp = false;
-      hbp_counter = 0; // Counter for timing the HBP (i.e. time after HSP, but before HDA).
-      h_adjust = HBP*2; // Amount to count in hbp_counter. Start at a high value and then sync back down.
-      h_adjust_countdown = REFRESH_FRAME*2;
-      v_shift = VBP*2; // This will try to find the vertical start of the image.
+    forward_sdl_events();
+    if (!frames->consume()) {
+      // Nothing new yet, so just wait a bit (or for an event) before checking again:
+      SDL_WaitEventTimeout(NULL, 1);
+      continue;
     }
-
-    check_performance();
-
-    clear_freshness(framebuffer);
-
-    //SMELL: In my RTL, I call the time that comes before the horizontal display area the BACK porch,
-    // even though arguably it comes first (so surely should be the FRONT), but this swapped naming
-    // comes from other charts and diagrams I was reading online at the time.
-
-    for (int i = 0; i < gRefreshLimit; ++i) {
-
-      if (h_adjust_countdown > 0) --h_adjust_countdown;
-
-      bool hsync_stopped = false;
-      bool vsync_stopped = false;
-      TB->tick();      hsync_stopped |= TB->hsync_stopped();      vsync_stopped |= TB->vsync_stopped();
-#ifdef USE_SPEAKER
-      TB->examine_condition_met |= TB->m_core->speaker;
-#endif // USE_SPEAKER
-
-#ifdef DOUBLE_CLOCK
-      TB->tick();      hsync_stopped |= TB->hsync_stopped();      vsync_stopped |= TB->vsync_stopped();
-#ifdef USE_SPEAKER
-      TB->examine_condition_met |= TB->m_core->speaker;
-#endif // USE_SPEAKER
-      // ^ We tick twice if the design halves the clock to produce the pixel clock.
-#endif // DOUBLE_CLOCK
-
-      if (hsync_stopped) {
-        count_hbp = true;
-        hbp_counter = 0;
-      }
-
-      int pixel_lit = TB->m_core->red | TB->m_core->green | TB->m_core->blue;
-
-      if (count_hbp) {
-        // We are counting the HBP before we start the next line.
-        if (hbp_counter >= h_adjust) {
-          // OK, counter ran out, so let's start our next line.
-          count_hbp = false;
-          hbp_counter = 0;
-          h = 0;
-          v++;
-        }
-        else if (pixel_lit) {
-          // If we got here, we got a display signal earlier than the current
-          // horizontal adjustment expects, so we need to adjust HBP to match
-          // HDA video signal, but only after the first full frame:
-          if (h_adjust_countdown <= 0) {
-            h_adjust = hbp_counter;
-            printf(
-              "[H,V,F=%4d,%4d,%2d] "
-              "Horizontal auto-adjust to %d after HSYNC\n",
-              h, v, TB->frame_counter,
-              h_adjust
-            );
-          }
-        }
-        else {
-          h++;
-          hbp_counter++;
-        }
-      }
-      else {
-        h++;
-      }
-
-      if (vsync_stopped) {
-        // Start a new frame.
-        v = 0;
-        // if (TB->frame_counter%60 == 0) overflow_test(framebuffer);
-        fade_overflow_region(framebuffer);
-      }
-
-      if (pixel_lit && h_adjust_countdown <= 0 && v < v_shift) {
-        v_shift = v;
-        printf(
-          "[H,V,F=%4d,%4d,%2d] "
-          "Vertical frame auto-shift to %d after VSYNC\n",
-          h, v, TB->frame_counter,
-          v_shift
-        );
-        gSyncLine = true;
-        gSyncFrame = true;
-      }
-
-      int x = h;
-      int y = v;
-
-#ifdef USE_SPEAKER
-      int speaker = (TB->m_core->speaker<<6);
-#else
-      int speaker = 0;
-#endif // USE_SPEAKER
-      int hilite = gHighlight ? HILITE : 0; // hilite turns on lower 5 bits to show which pixel(s) have been updated.
-
-      if (x >= 0 && x < WINDOW_WIDTH && y >= 0 && y < WINDOW_HEIGHT) {
-
-        int red  = (TB->m_core->red   << 6) | hilite; // Design drives upper 2 bits of each colour channel.
-        int green= (TB->m_core->green << 6) | hilite; 
-        int blue = (TB->m_core->blue  << 6) | hilite; 
-        framebuffer[(y*WINDOW_WIDTH + x)*4 + 2] = red   | (TB->m_core->hsync ? 0 : 0b1000'0000) | speaker;  // R
-        framebuffer[(y*WINDOW_WIDTH + x)*4 + 1] = green;                                                    // G
-        framebuffer[(y*WINDOW_WIDTH + x)*4 + 0] = blue  | (TB->m_core->vsync ? 0 : 0b1000'0000) | speaker;  // B.
-      }
-
-      if (gSyncLine && h==0) {
-        gSyncLine = false;
-        break;
-      }
-
-      if (gSyncFrame && v==0) {
-        gSyncFrame = false;
-        break;
-      }
-
-    }
-
-    overlay_display_area_frame(framebuffer, 0, v_shift);
-
-    SDL_UpdateTexture( texture, NULL, framebuffer, WINDOW_WIDTH * 4 );
-    SDL_RenderCopy( renderer, texture, NULL, NULL );
-    if (font) {
-      SDL_Rect rect;
-      SDL_Texture *text_texture = NULL;
-      // Show the state of controls that can be toggled:
-      string s = "[";
-      s += TB->paused           ? "P" : ".";
-      s += gGuides              ? "G" : ".";
-      s += gHighlight           ? "H" : ".";
-      s += TB->log_vsync        ? "V" : ".";
-      s += gOverrideVectors     ? "O" : ".";
-      s += TB->examine_mode     ? "X" : ".";
-      s += gLockInputs[LOCK_MAP]? "m" : ".";
-      s += gLockInputs[LOCK_L]  ? "<" : ".";
-      s += gLockInputs[LOCK_F]  ? "^" : ".";
-      s += gLockInputs[LOCK_B]  ? "v" : ".";
-      s += gLockInputs[LOCK_R]  ? ">" : ".";
-      s += gMouseCapture        ? "*" : ".";
-#ifdef INSPECT_INTERNAL
-      s += "] ";
-      // Player position:
-      s += " pX,Y=("
-        + to_string(fixed2double(TB->m_core->DESIGN->playerX)) + ", "
-        + to_string(fixed2double(TB->m_core->DESIGN->playerY)) + ") ";
-      s += " fX,Y=("
-        + to_string(fixed2double(TB->m_core->DESIGN->facingX)) + ", "
-        + to_string(fixed2double(TB->m_core->DESIGN->facingY)) + ") ";
-      s += " vX,Y=("
-        + to_string(fixed2double(TB->m_core->DESIGN->vplaneX)) + ", "
-        + to_string(fixed2double(TB->m_core->DESIGN->vplaneY)) + ") ";
-#endif
-      get_text_and_rect(renderer, 10, VFULL+10, s.c_str(), font, &text_texture, &rect);
-      if (text_texture) {
-        SDL_RenderCopy(renderer, text_texture, NULL, &rect);
-        SDL_DestroyTexture(text_texture);
-      }
-      else {
-        printf("Cannot create text_texture\n");
-      }
+    const sim_frame_t *frame = frames->front();
+    {
+      METRICS::SCOPE timer(gMetrics, METRICS::UPLOAD);
+      SDL_UpdateTexture( texture, NULL, frame->pixels, WINDOW_WIDTH * 4 );
+      SDL_RenderCopy( renderer, texture, NULL, NULL );
     }
-    if (gGuides) {
-      int ox = HDA/2;
-      int oy = VDA/2;
-      double s = VDA/4;
-      //SMELL: Add in grid-cell alignment too.
-      // Draw the design's current vectors in green:
-      SDL_SetRenderDrawColor(renderer, 0,255,0,255);
-      double fx = fixed2double(TB->m_core->DESIGN->facingX);
-      double fy = fixed2double(TB->m_core->DESIGN->facingY);
-      double vx = fixed2double(TB->m_core->DESIGN->vplaneX);
-      double vy = fixed2double(TB->m_core->DESIGN->vplaneY);
-      int lx = ox+(fx-vx)*s;
-      int ly = oy+(fy-vy)*s;
-      int rx = ox+(fx+vx)*s;
-      int ry = oy+(fy+vy)*s;
-      // Draw center directional line:
-      SDL_RenderDrawLine(renderer, ox, oy, ox+fx*s, oy+fy*s);
-      // Draw left camera vector:
-      SDL_RenderDrawLine(renderer, ox, oy, lx, ly);
-      // Draw right camera vector:
-      SDL_RenderDrawLine(renderer, ox, oy, rx, ry);
-      // Draw viewplane:
-      SDL_RenderDrawLine(renderer, lx, ly, rx, ry);
-      // Draw the box representing the position of the player in the current cell,
-      // i.e. just draw a unit square offset by the fractional part of the player position:
-      double px  = fixed2double(TB->m_core->DESIGN->playerX,  1); // Integer part.
-      double py  = fixed2double(TB->m_core->DESIGN->playerY,  1); // Integer part.
-      double pxf = fixed2double(TB->m_core->DESIGN->playerX, -1); // Fractional part.
-      double pyf = fixed2double(TB->m_core->DESIGN->playerY, -1); // Fractional part.
-      SDL_Rect r;
-      r.x = ox-pxf*s;
-      r.y = oy-pyf*s;
-      r.w = r.h = s;
-      SDL_RenderDrawRect(renderer, &r);
-      render_text(renderer, font, r.x+3, r.y+s-14, to_string(int(px)) + ", " + to_string(int(py)));
-      if (gOverrideVectors) {
-        // Now draw sim's overriding vectors over them, in white:
-        SDL_SetRenderDrawColor(renderer, 255,255,255,255);
-        lx = ox+(gOvers.fx-gOvers.vx)*s;
-        ly = oy+(gOvers.fy-gOvers.vy)*s;
-        rx = ox+(gOvers.fx+gOvers.vx)*s;
-        ry = oy+(gOvers.fy+gOvers.vy)*s;
-        // Draw center directional line:
-        SDL_RenderDrawLine(renderer, ox, oy, ox+gOvers.fx*VDA/4, oy+gOvers.fy*VDA/4);
-        // Draw left camera vector:
-        SDL_RenderDrawLine(renderer, ox, oy, lx, ly);
-        // Draw right camera vector:
-        SDL_RenderDrawLine(renderer, ox, oy, rx, ry);
-        // Draw viewplane:
-        SDL_RenderDrawLine(renderer, lx, ly, rx, ry);
-        // Draw box:
-        px = gOvers.px;
-        py = gOvers.py;
-        double dummy;
-        pxf = modf(px, &dummy);
-        pyf = modf(py, &dummy);
-        // Fix negative partials: //SMELL: Why is this necessary?
-        if (pxf < 0) pxf = pxf+1;
-        if (pyf < 0) pyf = pyf+1;
-        r.x = ox-pxf*s;
-        r.y = oy-pyf*s;
-        r.w = r.h = s;
-        SDL_RenderDrawRect(renderer, &r);
-      }
+    {
+      METRICS::SCOPE timer(gMetrics, METRICS::HUD);
+      render_hud(renderer, frame);
     }
+    METRICS::SCOPE timer(gMetrics, METRICS::PRESENT);
     SDL_RenderPresent(renderer);
   }
 
+  quit_simulation();
+  sim_thread.join();
+  delete frames;
+
+  gGlyphs.destroy(); // Before its renderer goes.
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
   SDL_Quit(); //SMELL: Should use SDL_QuitSubSystem instead? https://wiki.libsdl.org/SDL2/SDL_QuitSubSystem
   if (font) TTF_CloseFont(font);
   TTF_Quit();
 
-  delete framebuffer;
+  delete [] framebuffer;
+  gVideo.close();
+  close_capture();
+#ifdef TRACE
+  gWaves.close();
+#endif
+  gProfiler.close();
+  gMetrics.write(TB->m_tickcount, TB->frame_counter, true);
+  gMetrics.close();
+  close_recording();
 
   printf("Done at %lu ticks.\n", TB->m_tickcount);
   return EXIT_SUCCESS;
@@ -0,0 +1,111 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// SPI master for the design's vector interface (i_sclk, i_mosi, i_ss_n), as a stimulus
+// coroutine (see stimulus.h). send() queues a full 144-bit frame of vectors and returns
+// straight away. The frame then gets shifted out over the following ticks: /SS low, then
+// playerX, playerY, facingX, facingY, vplaneX, vplaneY (24 bits each, MSB first), with MOSI
+// changing while SCLK is low and the design sampling it on the rising edge (i.e. SPI mode 0),
+// then /SS high again. raybox.v copies a complete frame into ready_buffer, and loads it into
+// its vectors at the end of the visible area, as it would with a real MCU driving it.
+//
+// raybox.v syncs SCLK and /SS through shift registers, so each SCLK phase has to last at least
+// a couple of clocks. A frame takes about 4*144 ticks with the default half period of 2.
+// If send() is called while a frame is still going out, the newest vectors go out straight after
+// it (and anything sent in between is dropped), so the design always ends up with the latest.
+
+#include <stdint.h>
+#include <string.h>
+#include "stimulus.h"
+
+template<class CORE> class SPI_MASTER {
+public:
+  static const int kFrameBits = 144;
+
+  SPI_MASTER(STIMULUS &stimulus, CORE *core, int half_period = 2)
+    : m_stimulus(stimulus), m_core(core), m_half(half_period), m_busy(false), m_pending(false), m_frames(0)
+  {
+    memset(m_queued, 0, sizeof(m_queued));
+    idle_pins();
+  }
+
+  // Queue vectors (px, py, fx, fy, vx, vy, as raw Q12.12) to go out as the next SPI frame:
+  void send(const uint32_t *v) {
+    if ((m_busy || m_frames) && 0 == memcmp(v, m_queued, sizeof(m_queued))) return; // Already sent (or on its way).
+    memcpy(m_queued, v, sizeof(m_queued));
+    m_pending = true;
+    if (!m_busy) {
+      m_busy = true;
+      m_stimulus.spawn(run());
+    }
+  }
+
+  // True while a frame is going out, or queued to:
+  bool busy(void) const { return m_busy; }
+
+  // Number of complete frames sent so far:
+  unsigned long frames(void) const { return m_frames; }
+
+  // Make the next send() go out even if it repeats the last one, e.g. because the design was
+  // restored from a checkpoint and might not have those vectors any more:
+  void forget_sent(void) {
+    if (!m_busy) memset(m_queued, 0xFF, sizeof(m_queued)); // Never valid 24-bit vectors.
+  }
+
+private:
+  void idle_pins(void) {
+    m_core->i_ss_n = 1;
+    m_core->i_sclk = 0;
+    m_core->i_mosi = 0;
+  }
+
+  stim_task run(void) {
+    while (m_pending) {
+      uint32_t v[6];
+      memcpy(v, m_queued, sizeof(v));
+      m_pending = false;
+      m_core->i_ss_n = 0;
+      for (int i = 0; i < 6; ++i) {
+        for (int bit = 23; bit >= 0; --bit) {
+          m_core->i_sclk = 0;
+          m_core->i_mosi = (v[i] >> bit) & 1;
+          co_await ticks(m_half);
+          m_core->i_sclk = 1;
+          co_await ticks(m_half);
+        }
+      }
+      m_core->i_sclk = 0;
+      // Hold /SS until the design has seen the last SCLK rise get through its syncs:
+      co_await ticks(m_half + 4);
+      m_core->i_ss_n = 1;
+      co_await ticks(m_half);
+      ++m_frames;
+    }
+    idle_pins();
+    m_busy = false;
+  }
+
+  STIMULUS &m_stimulus;
+  CORE *m_core;
+  int m_half;
+  bool m_busy;
+  bool m_pending;
+  uint32_t m_queued[6];
+  unsigned long m_frames;
+};
@@ -0,0 +1,185 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Coroutine-based stimulus for the testbench (needs C++20). A stimulus is written as a plain
+// sequence of pin wiggles and waits, and runs a little on each tick without ever blocking
+// the sim loop, e.g.:
+//
+//  stim_task blink(VDESIGN *core) {
+//    for (;;) {
+//      core->i_ss_n = 0;
+//      co_await ticks(10);     // Resume after another 10 clock ticks.
+//      core->i_ss_n = 1;
+//      co_await vsync();       // Resume when the next VSYNC pulse starts.
+//    }
+//  }
+//  ...
+//  TB->stimulus.spawn(blink(TB->m_core));
+//
+// STIMULUS::tick() is called after every clock tick (MAIN_TB does this), and only costs a
+// compare or two unless some coroutine is due to run. Pins that a coroutine sets when it
+// resumes are seen by the design on the next tick.
+
+#include <stdint.h>
+#include <coroutine>
+#include <exception>
+#include <vector>
+
+// Return type of a stimulus coroutine. It starts suspended, and does nothing until it's
+// handed to STIMULUS::spawn(), which then owns it:
+class stim_task {
+public:
+  struct promise_type {
+    stim_task get_return_object() { return stim_task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() { }
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  stim_task(stim_task &&other) : m_handle(other.m_handle) { other.m_handle = nullptr; }
+  stim_task(const stim_task &) = delete;
+  ~stim_task() { if (m_handle) m_handle.destroy(); }
+
+  // Give up ownership (to STIMULUS):
+  std::coroutine_handle<> release(void) {
+    auto h = m_handle;
+    m_handle = nullptr;
+    return h;
+  }
+
+private:
+  explicit stim_task(std::coroutine_handle<promise_type> h) : m_handle(h) { }
+  std::coroutine_handle<promise_type> m_handle;
+};
+
+
+class STIMULUS {
+public:
+  STIMULUS(void) : m_now(0), m_next_wake(kNever), m_running(0) { }
+
+  ~STIMULUS() {
+    for (auto &w : m_tick_waiters) w.handle.destroy();
+    for (auto h : m_vsync_waiters) h.destroy();
+  }
+
+  // Start a coroutine: It runs up to its first co_await straight away.
+  void spawn(stim_task task) {
+    ++m_running;
+    resume(task.release());
+  }
+
+  // Number of coroutines that haven't finished yet:
+  int running(void) const { return m_running; }
+
+  // Called after every clock tick, with the tick count, and whether VSYNC has just started:
+  inline void tick(uint64_t now, bool vsync_started) {
+    m_now = now;
+    if (now >= m_next_wake) wake_due();
+    if (vsync_started && !m_vsync_waiters.empty()) wake_vsync();
+  }
+
+  uint64_t now(void) const { return m_now; }
+
+  // Tick count at which tick() next has a coroutine to wake (not counting VSYNC waiters), if ever:
+  uint64_t next_wake(void) const { return m_next_wake; }
+
+  // The STIMULUS that is running the current coroutine (for the ticks() and vsync() awaitables):
+  static STIMULUS *&current(void) {
+    static STIMULUS *s = nullptr;
+    return s;
+  }
+
+  void wait_ticks(std::coroutine_handle<> h, uint64_t n) {
+    uint64_t wake = m_now + n;
+    m_tick_waiters.push_back({ wake, h });
+    if (wake < m_next_wake) m_next_wake = wake;
+  }
+
+  void wait_vsync(std::coroutine_handle<> h) {
+    m_vsync_waiters.push_back(h);
+  }
+
+private:
+  static const uint64_t kNever = ~uint64_t(0);
+
+  typedef struct {
+    uint64_t wake;
+    std::coroutine_handle<> handle;
+  } tick_waiter_t;
+
+  void resume(std::coroutine_handle<> h) {
+    STIMULUS *outer = current();
+    current() = this;
+    h.resume();
+    current() = outer;
+    // If it's not done, it has already put itself on one of the waiter lists again:
+    if (h.done()) {
+      h.destroy();
+      --m_running;
+    }
+  }
+
+  void wake_due(void) {
+    // Take out everything that's due first, because resuming them can add new waiters:
+    std::vector<std::coroutine_handle<>> due;
+    m_next_wake = kNever;
+    size_t keep = 0;
+    for (size_t i = 0; i < m_tick_waiters.size(); ++i) {
+      tick_waiter_t w = m_tick_waiters[i];
+      if (w.wake <= m_now) {
+        due.push_back(w.handle);
+      } else {
+        m_tick_waiters[keep++] = w;
+        if (w.wake < m_next_wake) m_next_wake = w.wake;
+      }
+    }
+    m_tick_waiters.resize(keep);
+    for (auto h : due) resume(h);
+  }
+
+  void wake_vsync(void) {
+    std::vector<std::coroutine_handle<>> due;
+    due.swap(m_vsync_waiters);
+    for (auto h : due) resume(h);
+  }
+
+  uint64_t m_now;
+  uint64_t m_next_wake;
+  int m_running;
+  std::vector<tick_waiter_t> m_tick_waiters;
+  std::vector<std::coroutine_handle<>> m_vsync_waiters;
+};
+
+
+// co_await ticks(n): Resume after n more clock ticks (at least 1):
+struct ticks {
+  uint64_t n;
+  explicit ticks(uint64_t count) : n(count < 1 ? 1 : count) { }
+  bool await_ready(void) const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) const { STIMULUS::current()->wait_ticks(h, n); }
+  void await_resume(void) const noexcept { }
+};
+
+// co_await vsync(): Resume on the tick where the next VSYNC pulse starts:
+struct vsync {
+  bool await_ready(void) const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) const { STIMULUS::current()->wait_vsync(h); }
+  void await_resume(void) const noexcept { }
+};
@@ -0,0 +1,108 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// The F1..F10 test poses (raw Q12.12 px, py, fx, fy, vx, vy), shared by the main sim
+// (sim/sim_main.cpp) and the tracer-only bench (sim/tracer_bench.cpp).
+//NOTE: This defines gTestVectors, so include it from just one .cpp file per executable.
+
+#include <stdint.h>
+
+uint32_t gTestVectors[10][6] {
+  //NOTE: These are based on Q12.12...
+  { // F1: Shows 0 line on X:
+    0x00001800, // 1.500000
+    0x0000D800, // 13.500000
+    0x0000011E, // 0.069824
+    0x00FFF00B, // -0.997314
+    0x000007FA, // 0.498535
+    0x0000008F, // 0.034912
+  },
+  { // F2: Shows oversized column:
+    0x00001800, // 1.500000
+    0x0000D800, // 13.500000
+    0x00000198, // 0.099609
+    0x00FFF015, // -0.994873
+    0x000007F5, // 0.497314
+    0x000000CC, // 0.049805
+  },
+  { // F3: Shows undersized column:
+    0x00002172, // 2.090332
+    0x0000D681, // 13.406494
+    0x0000052F, // 0.323975
+    0x00FFF0DE, // -0.945801
+    0x00000791, // 0.472900
+    0x00000297, // 0.161865
+  },
+  { // F4: Another undersized column:
+    0x0000249A, // 2.287598
+    0x0000C860, // 12.523438
+    0x00000E9A, // 0.912598
+    0x00FFF977, // -0.408447
+    0x00000344, // 0.204102
+    0x0000074D, // 0.456299
+  },
+  { // F5: 0 line on Y:
+    0x0000250D, // 2.315674
+    0x0000BB16, // 11.692871
+    0x00000FF5, // 0.997314
+    0x00FFFEDF, // -0.070557
+    0x00000090, // 0.035156
+    0x000007FA, // 0.498535
+  },
+  { // F6: Testing a little "jitter" on a wall block edge:
+    0x000044C4, // 4.297852
+    0x0000BC33, // 11.762451
+    0x00000F7F, // 0.968506
+    0x00FFFC09, // -0.247803
+    0x000001FB, // 0.123779
+    0x000007BF, // 0.484131
+  },
+  { // F7: HACK: 0.53125 vplane:
+    0x00001800, // 1.500000
+    0x0000D800, // 13.500000
+    0x00000000, // 0.000000
+    0x00FFF000, // -1.000000
+    0x00000880, // 0.531250
+    0x00000000, // 0.000000
+  },
+  { // F8: HACK: 0.5625 vplane:
+    0x00001800, // 1.500000
+    0x0000D800, // 13.500000
+    0x00000000, // 0.000000
+    0x00FFF000, // -1.000000
+    0x00000900, // 0.562500
+    0x00000000, // 0.000000
+  },
+  { // F9: HACK: 0.625 vplane:
+    0x00001800, // 1.500000
+    0x0000D800, // 13.500000
+    0x00000000, // 0.000000
+    0x00FFF000, // -1.000000
+    0x00000A00, // 0.625000
+    0x00000000, // 0.000000
+  },
+  { // F10: HACK: 0.75 vplane:
+    0x00001800, // 1.500000
+    0x0000D800, // 13.500000
+    0x00000000, // 0.000000
+    0x00FFF000, // -1.000000
+    0x00000C00, // 0.750000
+    0x00000000, // 0.000000
+  },
+};
@@ -16,74 +16,98 @@
  */
 
 // #define TRACE
+// #define TRACE_FST  // As per TRACE, but FST instead of VCD (see the sim_fst target in the Makefile).
 
 #include "verilated.h"
-
-#ifdef TRACE
-#include <verilated_vcd_c.h>
+#include <type_traits>
+
+#ifdef TRACE_FST
+  #ifndef TRACE
+    #define TRACE
+  #endif
+  #include <verilated_fst_c.h>
+  typedef VerilatedFstC TRACE_FILE;
+#elif defined(TRACE)
+  #include <verilated_vcd_c.h>
+  typedef VerilatedVcdC TRACE_FILE;
 #endif
 
-template<class MODULE> class TESTBENCH {
+// Testbenches are statically dispatched (CRTP), rather than virtual, because tick() and friends
+// run on every simulated clock: A testbench that extends this one passes itself as DERIVED, e.g.
+// `class MY_TB : public TESTBENCH<Vmy_design, MY_TB>`, and then whichever of tick(), trace(),
+// print_time() etc it declares are what this calls, without a vtable in the way. With the default
+// DERIVED (void), TESTBENCH is used as-is.
+template<class MODULE, class DERIVED = void> class TESTBENCH {
 public:
+  typedef typename std::conditional<std::is_void<DERIVED>::value, TESTBENCH, DERIVED>::type SELF;
   static const int kClockPeriod = 20000; // 20,000pS clock period means 50MHz.
   static const int kClockEarly = 5000;   // We *affirm* a sample 5nS before raising the clock.
   unsigned long m_tickcount;
   MODULE *m_core;
 #ifdef TRACE
-  VerilatedVcdC *m_trace;
+  TRACE_FILE *m_trace;
 #endif
 
   TESTBENCH(void) {
 #ifdef TRACE
     Verilated::traceEverOn(true);
+    m_trace = NULL;
 #endif
     m_core = new MODULE;
     m_tickcount = 0l;
   }
 
-  virtual ~TESTBENCH(void) {
+  ~TESTBENCH(void) {
+#ifdef TRACE
+    closetrace();
+    delete m_trace;
+    m_trace = NULL;
+#endif
     delete m_core;
     m_core = NULL;
   }
 
 #ifdef TRACE
-  virtual void opentrace(const char *vcdname) {
+  // Start dumping every tick to a new trace file (.vcd, or .fst for TRACE_FST builds), closing
+  // any that's already open. The core only ever gets attached to one trace object (Verilator can't
+  // trace() the same model into another one), so later files reuse it, by closing and reopening:
+  void opentrace(const char *filename) {
     if (!m_trace) {
-      m_trace = new VerilatedVcdC;
+      m_trace = new TRACE_FILE;
       m_core->trace(m_trace, 99);
-      m_trace->open(vcdname);
     }
+    if (m_trace->isOpen()) m_trace->close();
+    m_trace->open(filename);
   }
 
-  virtual void closetrace(void) {
-    if (m_trace) {
-      m_trace->close();
-      m_trace = NULL;
-    }
+  void closetrace(void) {
+    if (m_trace && m_trace->isOpen()) m_trace->close();
   }
+
+  bool tracing(void) const { return m_trace && m_trace->isOpen(); }
 #endif
 
-  virtual void reset(void) {
+  void reset(void) {
     m_core->reset = 1;
     // Make sure any inheritance gets applied
-    this->tick();
+    self().tick();
     m_core->reset = 0;
   }
 
 #ifdef TRACE
-  virtual void trace(int stage) {
-    if (!m_trace) return;
+  void trace(int stage) {
+    if (!tracing()) return;
+    //NOTE: No flush() after each tick: The trace file buffers (and for FST, compresses) on its own,
+    // and flushing on every tick made tracing many times slower.
     switch (stage) {
-      case -1:  m_trace->dump(kClockPeriod*m_tickcount-kClockEarly);  break;
-      case 0:   m_trace->dump(kClockPeriod*m_tickcount);              break;
-      case 1:   m_trace->dump(kClockPeriod*m_tickcount+kClockPeriod/2);
-                m_trace->flush();
-                break;
+      case -1:  m_trace->dump(kClockPeriod*m_tickcount-kClockEarly);    break;
+      case 0:   m_trace->dump(kClockPeriod*m_tickcount);                break;
+      case 1:   m_trace->dump(kClockPeriod*m_tickcount+kClockPeriod/2); break;
     }
   }
 #endif
 
-  virtual void tick(void) {
+  void tick(void) {
     // Increment our own internal time reference
     m_tickcount++;
 
@@ -94,7 +118,7 @@ public:
     m_core->eval();
 #ifdef TRACE
     // Capture the state of things as they are a brief moment before we'll raise the clock:
-    trace(-1);
+    self().trace(-1);
 #endif
     // Toggle the clock...
 
@@ -103,18 +127,53 @@ public:
     m_core->eval();
 #ifdef TRACE
     // Capture the result of the rising edge of the clock:
-    trace(0);
+    self().trace(0);
 #endif
 
     // Falling edge
     m_core->clk = 0;
     m_core->eval();
 #ifdef TRACE
-    trace(1);
+    self().trace(1);
+#endif
+  }
+
+  // One clock, as per tick(), but with only the evals that a design
+  // clocked purely on posedge clk needs: Settle any inputs changed since the last clock (with clk
+  // low), then the rising edge. tick()'s extra falling-edge eval only does anything for negedge
+  // logic, or for a trace, so whenever a trace is open this just does a full tick() instead.
+  //NOTE: Leaves clk high, where tick() leaves it low. Outputs are the same either way.
+  inline void clock(void) {
+#ifdef TRACE
+    if (tracing()) {
+      TESTBENCH::tick();
+      return;
+    }
 #endif
+    m_tickcount++;
+    m_core->clk = 0;
+    m_core->eval();
+    m_core->clk = 1;
+    m_core->eval();
   }
 
-  virtual void print_time(void) {
+  // Run n clocks (see clock()):
+  void tick_n(unsigned long n) {
+    while (n--) clock();
+  }
+
+  // Run clocks until pred() is true (checked before each clock, so possibly before any at all),
+  // or until max clocks have run. Returns how many ran; the caller checks pred() again for a timeout:
+  template<class PRED> unsigned long run_until(PRED pred, unsigned long max) {
+    unsigned long n = 0;
+    while (n < max && !pred()) {
+      clock();
+      ++n;
+    }
+    return n;
+  }
+
+  void print_time(void) {
     long ns = m_tickcount*kClockPeriod/1'000L; // kClockPeriod is in pS, so convert to nS.
     // printf("[%3lu,%03lu,%03lu,%03luns] ", ns/1'000'000'000L, (ns/1'000'000L)%1'000L, (ns/1'000L)%1'000L, ns%1'000L);
     printf("[");
@@ -126,5 +185,9 @@ public:
     printf("%3lu,%03lu,%03lu,%03lu", ns/1'000'000'000L, (ns/1'000'000L)%1'000L, (ns/1'000L)%1'000L, ns%1'000L);
   }
 
-  virtual bool done(void) { return (Verilated::gotFinish()); }
+  bool done(void) { return (Verilated::gotFinish()); }
+
+protected:
+  // The most-derived testbench, for calling whatever version of a hook it has:
+  SELF &self(void) { return static_cast<SELF &>(*this); }
 };
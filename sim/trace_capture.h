@@ -0,0 +1,181 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Binary trace_buffer capture format, i.e. what the tracer produced for all 640 columns,
+// for any number of frames. Used by the sim's +capture option, and by utils/trace_tool.
+//
+// A capture file is a trace_capture_header_t followed by any number of fixed-size
+// trace_record_t, one per frame. Files are only ever appended to, so a capture that was
+// cut short (e.g. the sim was killed) is still readable up to its last complete record.
+//NOTE: All fields are little-endian (i.e. written as-is on x86 and ARM hosts).
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TRACE_CAPTURE_MAGIC     "RBTRACE\x1A"
+#define TRACE_CAPTURE_VERSION   1
+#define TRACE_CAPTURE_COLUMNS   640
+
+// Record flags:
+#define TRACE_RECORD_LEGACY     0b0001  // Converted from a legacy .hex capture: No vectors, and only side and an approximate vdist.
+
+typedef struct {
+  char      magic[8];       // TRACE_CAPTURE_MAGIC
+  uint16_t  version;        // TRACE_CAPTURE_VERSION
+  uint16_t  columns;        // TRACE_CAPTURE_COLUMNS
+  uint32_t  record_size;    // sizeof(trace_record_t), so readers can reject files they don't understand.
+} trace_capture_header_t;
+
+typedef struct {
+  uint32_t  frame;          // Frame number these traces were produced in.
+  uint32_t  flags;          // TRACE_RECORD_*
+  uint32_t  vectors[6];     // px, py, fx, fy, vx, vy (raw Q12.12) the tracer worked from.
+  uint32_t  columns[TRACE_CAPTURE_COLUMNS]; // See trace_pack().
+} trace_record_t;
+
+// Each column packs everything trace_buffer holds for it into 32 bits:
+// [15:0] vdist, [21:16] tex, [23:22] wtid, [24] side.
+inline uint32_t trace_pack(uint16_t vdist, uint8_t tex, uint8_t wtid, uint8_t side) {
+  return vdist | uint32_t(tex & 0x3F) << 16 | uint32_t(wtid & 3) << 22 | uint32_t(side & 1) << 24;
+}
+inline uint16_t trace_vdist (uint32_t c) { return c & 0xFFFF; }
+inline uint8_t  trace_tex   (uint32_t c) { return (c >> 16) & 0x3F; }
+inline uint8_t  trace_wtid  (uint32_t c) { return (c >> 22) & 3; }
+inline uint8_t  trace_side  (uint32_t c) { return (c >> 24) & 1; }
+
+
+
+// Appends records to a capture file, creating it (with its header) if it doesn't exist yet:
+class TRACE_CAPTURE_WRITER {
+public:
+  TRACE_CAPTURE_WRITER(void) : m_file(NULL), m_records(0) { }
+  ~TRACE_CAPTURE_WRITER() { close(); }
+
+  bool open(const char *filename) {
+    close();
+    m_file = fopen(filename, "ab");
+    if (!m_file) {
+      printf("ERROR: Cannot open trace capture file %s\n", filename);
+      return false;
+    }
+    // Records are small, but can come at a high rate, so let stdio batch them into big writes:
+    setvbuf(m_file, NULL, _IOFBF, 1<<20);
+    fseek(m_file, 0, SEEK_END);
+    if (ftell(m_file) == 0) {
+      trace_capture_header_t header;
+      make_header(header);
+      fwrite(&header, sizeof(header), 1, m_file);
+    }
+    else if (!check_existing(filename)) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  bool is_open(void) const { return m_file != NULL; }
+  unsigned long records(void) const { return m_records; }
+
+  bool write(const trace_record_t &record) {
+    if (!m_file) return false;
+    if (fwrite(&record, sizeof(record), 1, m_file) != 1) {
+      printf("ERROR: Cannot write to trace capture file\n");
+      close();
+      return false;
+    }
+    ++m_records;
+    return true;
+  }
+
+  void close(void) {
+    if (m_file) fclose(m_file);
+    m_file = NULL;
+  }
+
+  static void make_header(trace_capture_header_t &header) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_CAPTURE_VERSION;
+    header.columns = TRACE_CAPTURE_COLUMNS;
+    header.record_size = sizeof(trace_record_t);
+  }
+
+private:
+  // Only append to an existing file if it's the same format, and ends on a record boundary:
+  bool check_existing(const char *filename) {
+    long size = ftell(m_file);
+    FILE *f = fopen(filename, "rb");
+    trace_capture_header_t header, expect;
+    make_header(expect);
+    bool ok = f && fread(&header, sizeof(header), 1, f) == 1 && 0 == memcmp(&header, &expect, sizeof(header));
+    if (f) fclose(f);
+    if (!ok) {
+      printf("ERROR: %s exists, but is not a compatible trace capture file\n", filename);
+      return false;
+    }
+    if ((size - long(sizeof(header))) % long(sizeof(trace_record_t)) != 0) {
+      printf("ERROR: %s ends with a partial record; not appending to it\n", filename);
+      return false;
+    }
+    return true;
+  }
+
+  FILE *m_file;
+  unsigned long m_records;
+};
+
+
+
+// Reads records back from a capture file, in order:
+class TRACE_CAPTURE_READER {
+public:
+  TRACE_CAPTURE_READER(void) : m_file(NULL) { }
+  ~TRACE_CAPTURE_READER() { close(); }
+
+  bool open(const char *filename) {
+    close();
+    m_file = fopen(filename, "rb");
+    if (!m_file) {
+      printf("ERROR: Cannot open trace capture file %s\n", filename);
+      return false;
+    }
+    trace_capture_header_t header, expect;
+    TRACE_CAPTURE_WRITER::make_header(expect);
+    if (fread(&header, sizeof(header), 1, m_file) != 1 || 0 != memcmp(&header, &expect, sizeof(header))) {
+      printf("ERROR: %s is not a compatible trace capture file\n", filename);
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  // Returns false at the end of the file (including if the last record is incomplete):
+  bool next(trace_record_t &record) {
+    return m_file && fread(&record, sizeof(record), 1, m_file) == 1;
+  }
+
+  void close(void) {
+    if (m_file) fclose(m_file);
+    m_file = NULL;
+  }
+
+private:
+  FILE *m_file;
+};
@@ -0,0 +1,192 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Tracer-only bench: Drives sim/tracer_top.v (just tracer, map_rom and trace_buffer) through
+// the F1..F10 test poses as fast as it can. Each traced frame primes the tracer with enable
+// low for 1 clock, then holds enable high only until column 639 is stored, and moves straight
+// on to the next pose. Compared with the full sim, this skips the 307,200 visible pixels (and
+// the rest of the 420,000 clocks) of each frame, so it's for tracer optimisation work, where
+// only the traces matter.
+//
+// Plusargs:
+//  +frames=N       Trace N frames in total (default 10000).
+//  +pose=N         Only trace gTestVectors pose N (1..10), instead of cycling through all of them.
+//  +map=FILE       Replace the map loaded from MAP_FILE, e.g. +map=assets/map_64x64.hex
+//  +check          Check every traced frame (all 640 columns, and its clocks) against TRACER_MODEL.
+//  +max_clocks=N   Give up on a frame that takes more than N clocks (default 1000000), e.g.
+//                  because a ray escapes through a hole in the map and never hits a wall.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <chrono>
+#include "testbench.h"
+using namespace std;
+
+#include "Vtracer_top.h"
+#include "Vtracer_top_tracer_top.h" // Needed for accessing "verilator public" stuff in `tracer_top`
+
+#include "tracer_model.h"
+#include "test_vectors.h"
+#include "sim_common.h"
+
+#define DESIGN      tracer_top
+#define VDESIGN     Vtracer_top
+#define BASE_TB     TESTBENCH<VDESIGN>
+
+// Clocks the full design (sim/sim_main.cpp) spends per frame, for comparison:
+#define FULL_FRAME_CLOCKS (800*525)
+
+//SMELL: This doesn't do anything besides keeping certain linkers happy.
+// See: https://veripool.org/guide/latest/faq.html#why-do-i-get-undefined-reference-to-sc-time-stamp
+double sc_time_stamp() { return 0; }
+
+BASE_TB *TB;
+
+
+// Trace one frame with the given vectors: Returns the clocks the tracer took (from enable
+// going high, up to and including the clock that stores column 639), or -1 if it took more
+// than max_clocks.
+long trace_frame(const uint32_t *v, long max_clocks) {
+  auto *core = TB->m_core;
+  core->playerX = v[0];
+  core->playerY = v[1];
+  core->facingX = v[2];
+  core->facingY = v[3];
+  core->vplaneX = v[4];
+  core->vplaneY = v[5];
+  // Prime the tracer (as at the start of VBLANK in the full design):
+  core->enable = 0;
+  TB->tick();
+  core->enable = 1;
+  auto stored_last = [core] { return core->store && core->column == TRACER_MODEL::kColumns-1; };
+  long clocks = TB->run_until(stored_last, max_clocks);
+  if (!stored_last()) return -1;
+  // trace_buffer only takes the write on the next clock edge (while the tracer is in DONE):
+  TB->tick();
+  return clocks+1;
+}
+
+// Compare what's now in trace_buffer, and how long it took, with TRACER_MODEL.
+// Returns the number of mismatching columns (plus 1 if the clock count is off):
+int check_frame(const uint32_t *v, long clocks) {
+  static TRACER_MODEL model;
+  static tracer_column_t expect[TRACER_MODEL::kColumns];
+  static bool map_loaded = false;
+  auto *design = TB->m_core->DESIGN;
+  if (!map_loaded) {
+    int size = 1 << model.map_size_bits();
+    for (int col = 0; col < size; ++col) {
+      for (int row = 0; row < size; ++row) model.set_map(col, row, design->map->dummy_memory[col][row]);
+    }
+    map_loaded = true;
+  }
+  tracer_vectors_t tv = { v[0], v[1], v[2], v[3], v[4], v[5] };
+  long total = model.trace_frame(tv, expect);
+  int mismatches = 0;
+  int first = -1;
+  for (int col = 0; col < TRACER_MODEL::kColumns; ++col) {
+    const tracer_column_t &e = expect[col];
+    auto *traces = design->traces;
+    if (
+      traces->dummy_vdist_memory[col] != e.vdist ||
+      traces->dummy_tex_memory[col]   != e.tex   ||
+      traces->dummy_wtid_memory[col]  != e.wtid  ||
+      traces->dummy_side_memory[col]  != e.side
+    ) {
+      if (first < 0) first = col;
+      ++mismatches;
+    }
+  }
+  if (mismatches) {
+    printf("Trace check: %d of %d column(s) differ; first is column %d\n", mismatches, TRACER_MODEL::kColumns, first);
+  }
+  if (clocks != total) {
+    printf("Trace check: Tracer took %ld clocks, but the model says %ld\n", clocks, total);
+    ++mismatches;
+  }
+  return mismatches;
+}
+
+
+int main(int argc, char **argv) {
+  Verilated::commandArgs(argc, argv);
+  TB = new BASE_TB();
+
+  int frames      = get_plusarg_int("frames", 10000);
+  int pose        = get_plusarg_int("pose", 0);
+  long max_clocks = get_plusarg_int("max_clocks", 1'000'000);
+  bool check      = has_plusarg("check");
+  if (pose < 0 || pose > 10) {
+    printf("ERROR: +pose must be 1..10\n");
+    return EXIT_FAILURE;
+  }
+  string map_file;
+  if (get_plusarg("map", map_file) && !load_design_map(TB->m_core->DESIGN->map, map_file.c_str())) return EXIT_FAILURE;
+
+  printf("Tracer bench: %d frame(s)", frames);
+  if (pose) printf(" of pose F%d", pose); else printf(" cycling through poses F1..F10");
+  if (check) printf(", checking each against the model");
+  printf("\n");
+
+  TB->m_core->enable = 0;
+  TB->reset();
+
+  long pose_clocks[10] = {0}; // Clocks of the most recent frame of each pose.
+  int failed = 0;
+  int frame = 0;
+  auto start_time = chrono::steady_clock::now();
+  unsigned long start_ticks = TB->m_tickcount;
+
+  for (; frame < frames && !TB->done(); ++frame) {
+    int n = pose ? pose-1 : frame % 10;
+    long clocks = trace_frame(gTestVectors[n], max_clocks);
+    if (clocks < 0) {
+      printf("ERROR: Frame %d (pose F%d) didn't finish within %ld clocks\n", frame, n+1, max_clocks);
+      ++failed;
+      break;
+    }
+    pose_clocks[n] = clocks;
+    if (check && check_frame(gTestVectors[n], clocks)) {
+      printf("Trace check: Frame %d (pose F%d) FAILED\n", frame, n+1);
+      ++failed;
+    }
+  }
+
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+  unsigned long ticks = TB->m_tickcount - start_ticks;
+  double fps = elapsed > 0 ? frame / elapsed : 0;
+  long hz = elapsed > 0 ? long(ticks / elapsed) : 0;
+
+  for (int n = 0; n < 10; ++n) {
+    if (pose_clocks[n]) printf("  Pose F%-2d: %6ld clocks (%5.1f%% of VBLANK)\n", n+1, pose_clocks[n], 100.0*pose_clocks[n]/TRACER_MODEL::kVblankCycles);
+  }
+  printf("Tracer bench done: %d frame(s), %.3f s, %.1f frames/s, m_tickcount=", frame, elapsed, fps);
+  TB->print_big_num(TB->m_tickcount);
+  printf(" (");
+  TB->print_big_num(hz);
+  printf(" Hz)\n");
+  // What the full design would manage at the same clock rate, to see what skipping the rest of each frame buys:
+  double full_fps = double(hz) / FULL_FRAME_CLOCKS;
+  if (full_fps > 0) printf("  The full design would trace %.1f frames/s at this clock rate (%.0fx fewer)\n", full_fps, fps / full_fps);
+  // Same again, but in a form that's easy for scripts to pick up:
+  printf("RESULT: frames=%d ticks=%lu seconds=%.6f fps=%.1f hz=%ld failed=%d\n", frame, ticks, elapsed, fps, hz, failed);
+
+  TB->m_core->final();
+  delete TB;
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,238 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Bit-exact C++ model of src/rtl/tracer.v (and the reciprocal.v/lzc_b.v it uses) for Q12.12.
+// Given the same vectors and map, trace_frame() produces exactly what the tracer writes into
+// trace_buffer for each of the 640 columns (vdist, tex, wtid, side), plus how many clocks
+// the tracer FSM spends on each. Sprite outputs (spriteDist, spriteCol) are not modelled.
+//
+// All fixed-point values are held as raw 24-bit two's complement numbers in the low bits of
+// a uint32_t (i.e. the same as the design's `F registers), and every operation is masked back
+// to the width the RTL would have at that point.
+//NOTE: If the RTL changes (e.g. Qm/Qn, the reciprocal constants, or FSM states), this must too.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// Player position, facing direction, and viewplane, as raw Q12.12 (in the order of the design's SPI frame):
+typedef struct {
+  uint32_t px, py, fx, fy, vx, vy;
+} tracer_vectors_t;
+
+// What the tracer produces for one column:
+typedef struct {
+  uint16_t  vdist;  // visualWallDist[6:-9], i.e. UQ7.9 distance to the wall.
+  uint8_t   tex;    // wallX[-1:-6], i.e. texture column of the wall hit.
+  uint8_t   wtid;   // Wall type ID: map_val of the cell that was hit.
+  uint8_t   side;   // 0: Hit an X-side (vertical gridline); 1: Hit a Y-side.
+  bool      hit;    // False if kMaxSteps ran out first (e.g. a hole in the map); the rest is then meaningless.
+  uint32_t  rayDirX, rayDirY; // The ray this column traced, as raw Q12.12 (for diagnostics).
+  int       steps;  // Number of STEP/TEST iterations.
+  int       cycles; // Clocks the FSM spends on this column: PREP + steps*(STEP+TEST) + DONE.
+} tracer_column_t;
+
+class TRACER_MODEL {
+public:
+  static const int kQm = 12;
+  static const int kQn = 12;
+  static const int kColumns = 640;
+  // VGA timing as per vga_sync.v (one clock per pixel), for the clocks the tracer gets each frame,
+  // i.e. all of VBLANK (v in [kVDA,kVFull)). The sim measures this for itself, but tools with no design don't:
+  static const int kHFull = 800;
+  static const int kVFull = 525;
+  static const int kVDA = 480;
+  static const int kVblankCycles = (kVFull-kVDA)*kHFull;
+  static const int kMaxSteps = kVblankCycles/2;     // More steps than this couldn't possibly fit in a frame anyway.
+
+  // Raw values of constants as reciprocal.v computes them (1.466 and 1.0012, minus its ROUNDING_FIX):
+  static const uint32_t kN1466  = 0x1774;
+  static const uint32_t kN10012 = 0x1004;
+  static const uint32_t kNSat   = 0x7FFFFF;
+
+  TRACER_MODEL(int map_size_bits = 6) : m_map_bits(map_size_bits), m_map(size_t(1) << (2*map_size_bits), 0) { }
+
+  int map_size_bits(void) const { return m_map_bits; }
+
+  // Map is stored the same way map_rom.v's dummy_memory[col][row] is, i.e. in $readmemh order:
+  uint8_t map(int col, int row) const {
+    int mask = (1<<m_map_bits)-1;
+    return m_map[((col & mask) << m_map_bits) | (row & mask)];
+  }
+  void set_map(int col, int row, uint8_t val) {
+    int mask = (1<<m_map_bits)-1;
+    m_map[((col & mask) << m_map_bits) | (row & mask)] = val & 3; // map_rom.v outputs only BITS=2.
+  }
+
+  // Load a map the same way $readmemh would: Hex words, optional @address, and // comments.
+  // Anything the file doesn't cover is 0 (i.e. empty) here. In the Verilator build, those cells of
+  // map_rom are never written, so they only match this with +verilator+rand+reset+0 (the default):
+  // +verilator+rand+reset+1 makes them all ones, and +2 random. The sim's +check reads the design's
+  // own map_rom, so it's unaffected, but a standalone model run only matches a fully covered map.
+  bool load_map_hex(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+      printf("ERROR: Cannot open map file %s\n", filename);
+      return false;
+    }
+    std::fill(m_map.begin(), m_map.end(), 0);
+    size_t addr = 0;
+    char token[64];
+    while (fscanf(f, "%63s", token) == 1) {
+      if (token[0] == '/' && token[1] == '/') {
+        // Skip the rest of the line:
+        int c;
+        while ((c = fgetc(f)) != EOF && c != '\n') { }
+      }
+      else if (token[0] == '@') {
+        addr = strtoul(token+1, NULL, 16);
+      }
+      else if (isxdigit(token[0])) {
+        if (addr < m_map.size()) m_map[addr] = strtoul(token, NULL, 16) & 3;
+        ++addr;
+      }
+    }
+    fclose(f);
+    return true;
+  }
+
+  // reciprocal.v, with M=12, N=12. Returns raw Q12.12; sat is o_sat.
+  static uint32_t reciprocal(uint32_t i_data, bool i_abs, bool *sat = NULL) {
+    i_data &= M24;
+    bool sign = i_data & 0x800000;
+    uint32_t unsigned_data = sign ? ((~i_data + 1) & M24) : i_data;
+    int lzc_cnt = lzc24(unsigned_data);
+    int rescale_lzc = (kQm - lzc_cnt) & 0x7F;  // 7-bit, two's complement.
+    uint32_t a = (kQm >= lzc_cnt)
+      ? (unsigned_data >> (kQm - lzc_cnt))
+      : ((unsigned_data << (lzc_cnt - kQm)) & M24);
+    uint32_t b = (kN1466 - a) & M24;
+    int64_t  c = sext24(a) * sext24(b);                               // 48-bit product...
+    uint32_t d = (kN10012 - uint32_t(c >> kQn)) & M24;                // ...of which we want [11:-12].
+    int64_t  e = sext24(d) * sext24(b);
+    uint32_t f = uint32_t(e >> kQn) & M24;
+    uint32_t reci = (f & 0xC00000) ? kNSat : ((f << 2) & M24);        // Saturate if *4 would overflow.
+    uint64_t rescale_data = (rescale_lzc & 0x40)
+      ? (uint64_t(reci) << ((~rescale_lzc + 1) & 0x7F))
+      : (uint64_t(reci) >> rescale_lzc);
+    rescale_data &= M48;
+    bool o_sat = (rescale_data >> 24) != 0;
+    uint32_t sat_data = o_sat ? kNSat : uint32_t(rescale_data & M24);
+    if (sat) *sat = o_sat;
+    return (sign && !i_abs) ? ((~sat_data + 1) & M24) : sat_data;
+  }
+
+  // Trace a single column, given the tracer's rayAddendX/Y for it:
+  tracer_column_t trace_column(const tracer_vectors_t &v, uint32_t rayAddendX, uint32_t rayAddendY) const {
+    tracer_column_t out;
+    // rayDir = facing + (rayAddend>>>8):
+    uint32_t rayDirX = (v.fx + uint32_t(sext24(rayAddendX) >> 8)) & M24;
+    uint32_t rayDirY = (v.fy + uint32_t(sext24(rayAddendY) >> 8)) & M24;
+    bool rxi = sext24(rayDirX) > 0;
+    bool ryi = sext24(rayDirY) > 0;
+    uint32_t stepXdist = reciprocal(rayDirX, true);
+    uint32_t stepYdist = reciprocal(rayDirY, true);
+    // Initial partial step, from where the player is within their cell:
+    uint32_t fracX = v.px & 0xFFF;
+    uint32_t fracY = v.py & 0xFFF;
+    uint32_t partialX = rxi ? (0x1000 - fracX) : fracX;
+    uint32_t partialY = ryi ? (0x1000 - fracY) : fracY;
+    // PREP:
+    uint32_t trackXdist = mul_FF(stepXdist, partialX);
+    uint32_t trackYdist = mul_FF(stepYdist, partialY);
+    int mapX = (v.px >> kQn) & 0xFFF;   // `I is 12 bits, but only [MAP_SIZE_BITS-1:0] go to the map.
+    int mapY = (v.py >> kQn) & 0xFFF;
+    int side = 0;
+    int steps = 0;
+    uint8_t val = 0;
+    // STEP/TEST until we hit a wall:
+    while (steps < kMaxSteps) {
+      ++steps;
+      if (trackXdist < trackYdist) {    // Unsigned compare, as per `UF.
+        mapX = (mapX + (rxi ? 1 : -1)) & 0xFFF;
+        trackXdist = (trackXdist + stepXdist) & M24;
+        side = 0;
+      } else {
+        mapY = (mapY + (ryi ? 1 : -1)) & 0xFFF;
+        trackYdist = (trackYdist + stepYdist) & M24;
+        side = 1;
+      }
+      val = map(mapX, mapY);
+      if (val != 0) break;
+    }
+    // DONE; work out what gets stored:
+    uint32_t visualWallDist = side
+      ? ((trackYdist - stepYdist) & M24)
+      : ((trackXdist - stepXdist) & M24);
+    uint32_t wallX = side
+      ? ((v.px + mul_FF(visualWallDist, rayDirX)) & M24)
+      : ((v.py + mul_FF(visualWallDist, rayDirY)) & M24);
+    out.vdist   = (visualWallDist >> 3) & 0xFFFF;
+    out.tex     = (wallX >> 6) & 0x3F;
+    out.wtid    = val;
+    out.side    = side;
+    out.hit     = val != 0;
+    out.rayDirX = rayDirX;
+    out.rayDirY = rayDirY;
+    out.steps   = steps;
+    out.cycles  = 2 + 2*steps;
+    return out;
+  }
+
+  // Trace all 640 columns into cols (which must have room for kColumns), the same as
+  // the tracer does during one VBLANK. Returns the total clocks the FSM takes to finish
+  // the last column (including the initial SPRITE state), which needs to be no more
+  // than kVblankCycles for the design to complete the frame.
+  int trace_frame(const tracer_vectors_t &v, tracer_column_t *cols) const {
+    // Initial rayAddend = -vplane*320:
+    uint32_t rayAddendX = (0 - (v.vx << 8) - (v.vx << 6)) & M24;
+    uint32_t rayAddendY = (0 - (v.vy << 8) - (v.vy << 6)) & M24;
+    int cycles = 1; // SPRITE.
+    for (int col = 0; col < kColumns; ++col) {
+      cols[col] = trace_column(v, rayAddendX, rayAddendY);
+      cycles += cols[col].cycles;
+      rayAddendX = (rayAddendX + v.vx) & M24;
+      rayAddendY = (rayAddendY + v.vy) & M24;
+    }
+    return cycles;
+  }
+
+private:
+  static const uint32_t M24 = 0xFFFFFF;
+  static const uint64_t M48 = 0xFFFFFFFFFFFFull;
+
+  static int64_t sext24(uint32_t x) { return int64_t(int32_t(x << 8) >> 8); }
+
+  // `FF(a*b) for two `F values: [11:-12] of their signed 48-bit product:
+  static uint32_t mul_FF(uint32_t a, uint32_t b) { return uint32_t((sext24(a) * sext24(b)) >> kQn) & M24; }
+
+  // lzc_b.v for WIDTH=24 (including 24 for an input of 0):
+  static int lzc24(uint32_t x) {
+    int n = 0;
+    for (uint32_t bit = 0x800000; bit && !(x & bit); bit >>= 1) ++n;
+    return n;
+  }
+
+  int m_map_bits;
+  std::vector<uint8_t> m_map;
+};
@@ -0,0 +1,222 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Profiles how the tracer FSM (src/rtl/tracer.v) spends its VBLANK clock budget.
+// The sim calls sample() with the tracer's state and col_counter on every VBLANK clock,
+// i.e. for the clock edges where the FSM is enabled, then end_frame() after the last one.
+// Per frame, this counts the clocks spent in each state, both for each column and in total,
+// and how long it took to finish all columns. A frame where the FSM was still going when
+// VBLANK ended (i.e. v wrapped to 0) is "torn": Some columns didn't get traced in time.
+// A frame's budget is however many VBLANK clocks were actually sampled for it, so it follows
+// whatever the design's timing is.
+//
+// Results go to three CSV files:
+//  PREFIX_frames.csv:     One row per frame: Its vectors, clocks in each state, and budget usage,
+//                         then for each of PREP, STEP, TEST and DONE, a histogram of how many of
+//                         the frame's columns spent 0, 1, 2-3, 4-7 ... 64+ clocks in that state.
+//  PREFIX_columns.csv:    One row per column per frame: Clocks in each state for that column.
+//  PREFIX_histograms.csv: One row per column, written at the end: The same histograms, but of how
+//                         many frames that column spent 0, 1, 2-3 ... clocks in each state.
+// Totals alone can't tell a few very long rays (e.g. down a corridor) from many slightly slower ones.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+class TRACER_PROFILER {
+public:
+  // Must match the localparams in tracer.v:
+  enum { SPRITE = 0, PREP, STEP, TEST, DONE, STATES };
+  static const int kColumns = 640;
+  static const int kLastColumn = kColumns-1;
+  static const int kHistStates = 4;   // PREP, STEP, TEST, DONE (SPRITE only happens once per frame).
+  static const int kHistBuckets = 8;  // 0, 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64+ clocks.
+
+  TRACER_PROFILER(void) : m_frames_csv(NULL), m_columns_csv(NULL) { reset_totals(); discard_frame(); }
+  ~TRACER_PROFILER() { close(); }
+
+  bool open(const char *prefix) {
+    close();
+    std::string frames = std::string(prefix) + "_frames.csv";
+    std::string columns = std::string(prefix) + "_columns.csv";
+    m_histograms_name = std::string(prefix) + "_histograms.csv";
+    m_frames_csv = fopen(frames.c_str(), "w");
+    m_columns_csv = fopen(columns.c_str(), "w");
+    if (!m_frames_csv || !m_columns_csv) {
+      printf("ERROR: Cannot write tracer profile to %s and %s\n", frames.c_str(), columns.c_str());
+      close();
+      return false;
+    }
+    fprintf(m_frames_csv, "frame,px,py,fx,fy,vx,vy,sprite,prep,step,test,done,columns_done,busy,budget,headroom,torn");
+    write_hist_header(m_frames_csv);
+    fprintf(m_columns_csv, "frame,column,sprite,prep,step,test,done,total\n");
+    reset_totals();
+    discard_frame();
+    return true;
+  }
+
+  bool is_open(void) const { return m_frames_csv != NULL; }
+
+  // Record one VBLANK clock, where state and col are what the FSM has as it acts on that clock edge:
+  void sample(int state, int col) {
+    int clock = m_clocks++;
+    if (m_finished_at >= 0) return; // Just hanging in DONE after the last column.
+    if (state >= STATES || col >= kColumns) return;
+    ++m_cycles[col][state];
+    if (state == DONE && col == kLastColumn) m_finished_at = clock+1;
+  }
+
+  // Forget whatever has been sampled for the current frame (e.g. because a reset interrupted VBLANK):
+  void discard_frame(void) {
+    memset(m_cycles, 0, sizeof(m_cycles));
+    m_clocks = 0;
+    m_finished_at = -1;
+  }
+
+  // Called after the last clock of VBLANK, to write out the frame's results:
+  void end_frame(uint32_t frame, const uint32_t vectors[6]) {
+    if (!is_open() || m_clocks == 0) return;
+    int state_totals[STATES] = {0};
+    int frame_hist[kHistStates][kHistBuckets] = {};
+    int columns_done = 0;
+    for (int col = 0; col < kColumns; ++col) {
+      int total = 0;
+      for (int s = 0; s < STATES; ++s) {
+        state_totals[s] += m_cycles[col][s];
+        total += m_cycles[col][s];
+      }
+      for (int h = 0; h < kHistStates; ++h) {
+        int b = bucket(m_cycles[col][PREP+h]);
+        ++frame_hist[h][b];
+        ++m_column_hist[col][h][b];
+      }
+      columns_done += m_cycles[col][DONE];
+      if (total) {
+        fprintf(m_columns_csv, "%u,%d,%d,%d,%d,%d,%d,%d\n", frame, col,
+          m_cycles[col][SPRITE], m_cycles[col][PREP], m_cycles[col][STEP], m_cycles[col][TEST], m_cycles[col][DONE], total);
+      }
+      if (total > m_worst_column) m_worst_column = total;
+    }
+    bool torn = m_finished_at < 0;
+    int busy = torn ? m_clocks : m_finished_at;
+    fprintf(m_frames_csv, "%u", frame);
+    for (int i = 0; i < 6; ++i) fprintf(m_frames_csv, ",%.6f", q12_12(vectors[i]));
+    fprintf(m_frames_csv, ",%d,%d,%d,%d,%d,%d,%d,%d,%d,%d",
+      state_totals[SPRITE], state_totals[PREP], state_totals[STEP], state_totals[TEST], state_totals[DONE],
+      columns_done, busy, m_clocks, m_clocks-busy, torn);
+    write_hist(m_frames_csv, frame_hist);
+    if (torn) {
+      printf("Tracer profile: Frame %u is TORN: Only %d of %d columns finished within VBLANK\n", frame, columns_done, kColumns);
+      ++m_torn;
+    }
+    if (busy > m_worst_busy) {
+      m_worst_busy = busy;
+      m_worst_budget = m_clocks;
+      m_worst_frame = frame;
+    }
+    m_busy_sum += busy;
+    ++m_frames;
+    discard_frame();
+  }
+
+  // Print a summary, write the per-column histograms, and close the CSV files:
+  void close(void) {
+    if (is_open() && m_frames) write_column_histograms();
+    if (is_open() && m_frames) {
+      printf(
+        "Tracer profile: %d frame(s), mean %.0f clocks, worst %d clocks (frame %u; %.1f%% of its %d budget), "
+        "worst column %d clocks, %d torn frame(s)\n",
+        m_frames, double(m_busy_sum)/m_frames, m_worst_busy, m_worst_frame,
+        m_worst_budget ? 100.0*m_worst_busy/m_worst_budget : 0, m_worst_budget, m_worst_column, m_torn
+      );
+    }
+    if (m_frames_csv) fclose(m_frames_csv);
+    if (m_columns_csv) fclose(m_columns_csv);
+    m_frames_csv = m_columns_csv = NULL;
+  }
+
+  int torn_frames(void) const { return m_torn; }
+
+private:
+  static double q12_12(uint32_t raw) { return double(int32_t(raw << 8) >> 8) / 4096.0; }
+
+  void reset_totals(void) {
+    m_frames = m_torn = m_worst_busy = m_worst_budget = m_worst_column = 0;
+    m_worst_frame = 0;
+    m_busy_sum = 0;
+    memset(m_column_hist, 0, sizeof(m_column_hist));
+  }
+
+  // Histogram bucket for a number of clocks: 0 for 0, 1 for 1, then 2 for 2-3, 3 for 4-7, and so on:
+  static int bucket(int clocks) {
+    int b = 0;
+    while (clocks > 0 && b < kHistBuckets-1) { clocks >>= 1; ++b; }
+    return b;
+  }
+
+  // Header fields for a set of histograms, e.g. prep_h0,prep_h1,prep_h2,prep_h4 ... done_h64,
+  // each named for the fewest clocks its bucket counts:
+  static void write_hist_header(FILE *f) {
+    static const char *names[kHistStates] = { "prep", "step", "test", "done" };
+    for (int h = 0; h < kHistStates; ++h) {
+      for (int b = 0; b < kHistBuckets; ++b) fprintf(f, ",%s_h%d", names[h], b ? 1 << (b-1) : 0);
+    }
+    fprintf(f, "\n");
+  }
+
+  static void write_hist(FILE *f, const int hist[kHistStates][kHistBuckets]) {
+    for (int h = 0; h < kHistStates; ++h) {
+      for (int b = 0; b < kHistBuckets; ++b) fprintf(f, ",%d", hist[h][b]);
+    }
+    fprintf(f, "\n");
+  }
+
+  void write_column_histograms(void) {
+    FILE *f = fopen(m_histograms_name.c_str(), "w");
+    if (!f) {
+      printf("ERROR: Cannot write tracer profile histograms to %s\n", m_histograms_name.c_str());
+      return;
+    }
+    fprintf(f, "column");
+    write_hist_header(f);
+    for (int col = 0; col < kColumns; ++col) {
+      fprintf(f, "%d", col);
+      write_hist(f, m_column_hist[col]);
+    }
+    fclose(f);
+  }
+
+  FILE *m_frames_csv;
+  FILE *m_columns_csv;
+  std::string m_histograms_name;
+  // Current frame:
+  int m_cycles[kColumns][STATES];
+  int m_clocks;           // VBLANK clocks sampled so far.
+  int m_finished_at;      // Clocks it took to finish the last column, or -1 if it hasn't yet.
+  // Whole run:
+  int m_frames;
+  int m_torn;
+  int m_worst_busy;
+  int m_worst_budget;     // VBLANK clocks in the frame that had m_worst_busy.
+  uint32_t m_worst_frame;
+  int m_worst_column;
+  long m_busy_sum;
+  int m_column_hist[kColumns][kHistStates][kHistBuckets]; // Frames each column spent so many clocks in each state.
+};
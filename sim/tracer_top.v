@@ -0,0 +1,102 @@
+// SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// SPDX-License-Identifier: Apache-2.0
+
+// Sim-only top for benchmarking the tracer on its own (see sim/tracer_bench.cpp):
+// Just tracer, map_rom and trace_buffer, wired up the same way raybox.v wires them for
+// VBLANK, but with none of vga_sync, the SPI vector loading, or the per-pixel wall,
+// texture and sprite pipeline. The vectors come straight in as ports, and the tracer
+// runs whenever enable is high, instead of only during VBLANK.
+
+`default_nettype none
+`timescale 1ns / 1ps
+
+`include "fixed_point_params.v"
+
+module tracer_top(
+    input               clk,
+    input               reset,
+    input               enable,             // Low for at least 1 clock primes the tracer for a new frame.
+    input   `FExt       playerX,
+    input   `FExt       playerY,
+    input   `FExt       facingX,
+    input   `FExt       facingY,
+    input   `FExt       vplaneX,
+    input   `FExt       vplaneY,
+    output              store,              // High when the tracer is writing a column into trace_buffer...
+    output  [9:0]       column              // ...and this is that column.
+);
+
+    localparam MAP_SIZE_BITS        = 6;    // Must match raybox.v.
+
+    wire                tracer_side;
+    wire [`DII:`DFI]    tracer_dist;
+    wire [5:0]          tracer_texX;
+
+    // The tracer only ever writes to trace_buffer here; the bench reads it back via its
+    // "verilator public" memories instead:
+    wire                wall_side   = store ? tracer_side   : 1'bz;
+    wire [1:0]          wall_wtid   = store ? map_val       : 2'bz;
+    wire [`DII:`DFI]    wall_dist   = store ? tracer_dist   : { `Dbits{1'bz} };
+    wire [5:0]          wall_texX   = store ? tracer_texX   : 6'bz;
+
+    trace_buffer traces(
+        .clk    (clk),
+        .column (column),
+        .side   (wall_side),
+        .wtid   (wall_wtid),
+        .vdist  (wall_dist),
+        .tex    (wall_texX),
+        .cs     (1),
+        .we     (store),
+        .oe     (!store)
+    );
+
+    wire [MAP_SIZE_BITS-1:0] map_row, map_col;
+    wire [1:0] map_val;
+    tracer #(.MAP_SIZE_BITS(MAP_SIZE_BITS)) tracer (
+        // Inputs to tracer:
+        .clk        (clk),
+        .reset      (reset),
+        .enable     (enable),
+        .map_val    (map_val),
+        .playerX    (playerX),
+        .playerY    (playerY),
+        .facingX    (facingX),
+        .facingY    (facingY),
+        .vplaneX    (vplaneX),
+        .vplaneY    (vplaneY),
+        .debug_frame(0),
+        // Outputs from tracer:
+        .map_col    (map_col),
+        .map_row    (map_row),
+        .store      (store),
+        .column     (column),
+        .side       (tracer_side),
+        .vdist      (tracer_dist),
+        .tex        (tracer_texX),
+        // Sprite outputs are unused here:
+        .spriteStore(),
+        .spriteIndex(),
+        .spriteDist (),
+        .spriteCol  ()
+    );
+
+    map_rom #(.COLBITS(MAP_SIZE_BITS), .ROWBITS(MAP_SIZE_BITS)) map(
+        .col    (map_col),
+        .row    (map_row),
+        .val    (map_val)
+    );
+
+endmodule
@@ -0,0 +1,226 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Streams every frame the sim completes to a file or pipe (+video=FILE), as one of:
+//  Y4M:  YUV4MPEG2, 4:4:4 (BT.601, limited range), which ffmpeg, mpv etc read as-is.
+//  PPM:  One binary PPM (P6) after another, e.g. for `ffmpeg -f image2pipe -i -`.
+//  RGB:  Raw RGB24 frames with no header, e.g. for `ffmpeg -f rawvideo -pixel_format rgb24 -video_size 640x480 -i -`.
+//
+// push() only copies the frame into a slot of a fixed-size queue. A writer thread converts it
+// and does the actual I/O, so a slow disk or pipe never holds up the sim directly. If the queue
+// fills up, push() either waits for a free slot (lossless, e.g. headless runs, where every frame
+// matters more than speed) or drops the frame and counts it (e.g. windowed, which should keep running).
+//NOTE: A filename of "-" writes to stdout, and sends the sim's own stdout output to stderr instead.
+// Call claim_stdout() before printing anything, so none of that ends up in the video.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+  #include <io.h>
+  #include <fcntl.h>
+#else
+  #include <unistd.h>
+#endif
+
+class VIDEO_WRITER {
+public:
+  enum { Y4M, PPM, RGB };
+
+  VIDEO_WRITER(void) : m_file(NULL), m_frames(0), m_dropped(0), m_closing(false), m_skip(false) { }
+  ~VIDEO_WRITER() { close(); }
+
+  // Format for a filename's extension (.y4m, .ppm, or anything else is raw RGB; "-" is Y4M):
+  static int format_for(const char *filename) {
+    size_t len = strlen(filename);
+    if (0 == strcmp(filename, "-")) return Y4M;
+    if (len > 4 && 0 == strcmp(filename + len - 4, ".y4m")) return Y4M;
+    if (len > 4 && 0 == strcmp(filename + len - 4, ".ppm")) return PPM;
+    return RGB;
+  }
+
+  // Keep the real stdout for video, and send everything else printed to stdout to stderr.
+  // Only does this the first time; returns the real stdout each time (or NULL if it fails):
+  static FILE *claim_stdout(void) {
+    static FILE *video = NULL;
+    static bool claimed = false;
+    if (claimed) return video;
+    claimed = true;
+    fflush(stdout);
+#ifdef _WIN32
+    int fd = _dup(_fileno(stdout));
+    _dup2(_fileno(stderr), _fileno(stdout));
+    if (fd >= 0) _setmode(fd, _O_BINARY);
+    video = fd >= 0 ? _fdopen(fd, "wb") : NULL;
+#else
+    int fd = dup(fileno(stdout));
+    dup2(fileno(stderr), fileno(stdout));
+    video = fd >= 0 ? fdopen(fd, "wb") : NULL;
+#endif
+    return video;
+  }
+
+  // Stream width x height frames, at fps_num/fps_den frames per second (only used by Y4M),
+  // through a queue of `depth` frames:
+  bool open(const char *filename, int format, int width, int height, int fps_num, int fps_den, int depth, bool lossless) {
+    close();
+    m_file = 0 == strcmp(filename, "-") ? claim_stdout() : fopen(filename, "wb");
+    if (!m_file) {
+      printf("ERROR: Cannot write video to %s\n", filename);
+      return false;
+    }
+    m_format = format;
+    m_width = width;
+    m_height = height;
+    m_lossless = lossless;
+    m_frames = m_dropped = 0;
+    m_closing = false;
+    if (depth < 1) depth = 1;
+    m_slots.assign(depth, std::vector<uint8_t>(size_t(width)*height*4));
+    m_free.clear();
+    m_full.clear();
+    for (int i = 0; i < depth; ++i) m_free.push_back(i);
+    m_out.resize(size_t(width)*height*3);
+    if (m_format == Y4M) {
+      int g = std::gcd(fps_num, fps_den);
+      fprintf(m_file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n", width, height, fps_num/g, fps_den/g);
+    }
+    m_thread = std::thread(&VIDEO_WRITER::writer, this);
+    return true;
+  }
+
+  bool is_open(void) const { return m_file != NULL; }
+
+  // While on, push() ignores frames (e.g. junk ones the sim runs out after a reset):
+  void skip(bool on) { m_skip = on; }
+
+  // Queue a frame: width x height BGRA pixels (as per the sim's framebuffer), stride bytes apart per row:
+  void push(const uint8_t *bgra, int stride) {
+    if (!m_file || m_skip) return;
+    int slot;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (m_free.empty()) {
+        if (!m_lossless) {
+          ++m_dropped;
+          return;
+        }
+        m_cv_free.wait(lock, [this] { return !m_free.empty(); });
+      }
+      slot = m_free.front();
+      m_free.pop_front();
+    }
+    uint8_t *dst = m_slots[slot].data();
+    for (int y = 0; y < m_height; ++y) memcpy(dst + size_t(y)*m_width*4, bgra + size_t(y)*stride, m_width*4);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_full.push_back(slot);
+    }
+    m_cv_full.notify_one();
+  }
+
+  // Write out everything still queued, then stop:
+  void close(void) {
+    if (!m_file) return;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closing = true;
+    }
+    m_cv_full.notify_one();
+    m_thread.join();
+    fclose(m_file);
+    m_file = NULL;
+    printf("Video: %lu frame(s) written, %lu dropped\n", m_frames, m_dropped);
+  }
+
+private:
+  static const uint8_t kColour = 0xC0;
+
+  // WRITER thread: Convert and write each queued frame, in order:
+  void writer(void) {
+    for (;;) {
+      int slot;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv_full.wait(lock, [this] { return !m_full.empty() || m_closing; });
+        if (m_full.empty()) return; // Closing, and nothing left to write.
+        slot = m_full.front();
+        m_full.pop_front();
+      }
+      convert(m_slots[slot].data());
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(slot);
+      }
+      m_cv_free.notify_one();
+      write_frame();
+      ++m_frames;
+    }
+  }
+
+  // Fill m_out from a BGRA frame: Y, Cb and Cr planes for Y4M, otherwise packed RGB.
+  // Only the upper 2 bits of each channel are the design's colour. The sim's framebuffer uses the
+  // lower ones for its own markers (HILITE freshness tint, hsync/vsync, speaker), so mask them off:
+  void convert(const uint8_t *p) {
+    size_t n = size_t(m_width)*m_height;
+    uint8_t *out = m_out.data();
+    if (m_format == Y4M) {
+      for (size_t i = 0; i < n; ++i, p += 4) {
+        int r = p[2] & kColour, g = p[1] & kColour, b = p[0] & kColour;
+        out[i]     = (( 66*r + 129*g +  25*b + 128) >> 8) + 16;
+        out[n+i]   = ((-38*r -  74*g + 112*b + 128) >> 8) + 128;
+        out[2*n+i] = ((112*r -  94*g -  18*b + 128) >> 8) + 128;
+      }
+    } else {
+      for (size_t i = 0; i < n; ++i, p += 4, out += 3) {
+        out[0] = p[2] & kColour;
+        out[1] = p[1] & kColour;
+        out[2] = p[0] & kColour;
+      }
+    }
+  }
+
+  void write_frame(void) {
+    if (m_format == Y4M) fputs("FRAME\n", m_file);
+    if (m_format == PPM) fprintf(m_file, "P6\n%d %d\n255\n", m_width, m_height);
+    fwrite(m_out.data(), m_out.size(), 1, m_file);
+  }
+
+  FILE *m_file;
+  int m_format;
+  int m_width, m_height;
+  bool m_lossless;
+  unsigned long m_frames;   // Only touched by the writer thread, until it's joined.
+  unsigned long m_dropped;
+  bool m_closing;
+  bool m_skip;
+  std::vector<std::vector<uint8_t>> m_slots;  // BGRA frames, owned by whichever of m_free/m_full holds their index.
+  std::deque<int> m_free, m_full;
+  std::vector<uint8_t> m_out;                 // Converted frame, belonging to the writer thread.
+  std::mutex m_mutex;
+  std::condition_variable m_cv_free, m_cv_full;
+  std::thread m_thread;
+};
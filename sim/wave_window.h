@@ -0,0 +1,140 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+// Triggered waveform capture, for TRACE builds of the sim (ideally TRACE_FST; see testbench.h).
+// Rather than dumping from time zero, this only has the testbench dump around a trigger:
+//
+//  - While ARMED with a pre-trigger window of N frames, each frame gets dumped to its own file,
+//    and only the last N of them are kept: a ring of files, like a logic analyser's pre-trigger
+//    buffer. With no pre-trigger window, nothing gets dumped until the trigger.
+//  - trigger() keeps those, and dumps on (into one file) from there until `post` more frames
+//    have ended. Then it disarms again, so the whole capture is at most pre+1+post frames.
+//
+// Files are PREFIX_FFFFFF.EXT, with FFFFFF the frame each one starts in. The sim calls
+// frame_boundary() between frames, and trigger() from wherever its trigger conditions are.
+
+#include <stdio.h>
+#include <string>
+#include <deque>
+
+template<class TB_T> class WAVE_WINDOW {
+public:
+  WAVE_WINDOW(void) : m_tb(NULL), m_pre(0), m_post(0), m_state(IDLE), m_frames_left(0) { }
+
+  void init(TB_T *tb, const std::string &prefix, const char *ext, int pre, int post) {
+    m_tb = tb;
+    m_prefix = prefix;
+    m_ext = ext;
+    m_pre = pre < 0 ? 0 : pre;
+    m_post = post < 0 ? 0 : post;
+  }
+
+  bool armed(void) const { return m_state == ARMED; }
+  bool capturing(void) const { return m_state == TRIGGERED; }
+
+  // Arm (i.e. start the pre-trigger ring, if any, and wait for a trigger), or disarm,
+  // which throws away the pre-trigger ring but finishes off any capture in progress:
+  void arm(bool on, int frame) {
+    if (!m_tb) return;
+    if (on && m_state == IDLE) {
+      m_state = ARMED;
+      printf("Waves: Armed (%d frame(s) before trigger, %d after)\n", m_pre, m_post);
+      if (m_pre) open_segment(frame);
+    } else if (!on && m_state == ARMED) {
+      if (!m_segment.empty()) {
+        close_segment();
+        m_ring.push_back(m_last_closed);
+      }
+      while (!m_ring.empty()) drop_oldest();
+      m_state = IDLE;
+      printf("Waves: Disarmed\n");
+    } else if (!on && m_state == TRIGGERED) {
+      finish();
+    }
+  }
+
+  // Start capturing now, keeping whatever the pre-trigger ring holds:
+  void trigger(const char *why, int frame) {
+    if (m_state != ARMED) return;
+    printf("Waves: Triggered by %s in frame %d\n", why, frame);
+    if (m_segment.empty()) open_segment(frame);
+    m_state = TRIGGERED;
+    m_frames_left = m_post + 1; // The rest of this frame, then m_post more.
+  }
+
+  // Called between frames, i.e. after the last tick of one, and before the first of the next:
+  void frame_boundary(int next_frame) {
+    if (m_state == ARMED && m_pre) {
+      // Rotate the pre-trigger ring:
+      close_segment();
+      m_ring.push_back(m_last_closed);
+      while ((int)m_ring.size() > m_pre) drop_oldest();
+      open_segment(next_frame);
+    } else if (m_state == TRIGGERED && --m_frames_left <= 0) {
+      finish();
+    }
+  }
+
+  // Stop, keeping anything captured so far:
+  void close(void) {
+    if (m_state == TRIGGERED) finish();
+    else arm(false, 0);
+  }
+
+private:
+  enum { IDLE, ARMED, TRIGGERED };
+
+  void open_segment(int frame) {
+    char name[32];
+    snprintf(name, sizeof(name), "_%06d.", frame);
+    m_segment = m_prefix + name + m_ext;
+    m_tb->opentrace(m_segment.c_str());
+  }
+
+  void close_segment(void) {
+    if (m_segment.empty()) return;
+    m_tb->closetrace();
+    m_last_closed = m_segment;
+    m_segment.clear();
+  }
+
+  void drop_oldest(void) {
+    remove(m_ring.front().c_str());
+    m_ring.pop_front();
+  }
+
+  void finish(void) {
+    close_segment();
+    printf("Waves: Captured");
+    for (auto &f : m_ring) printf(" %s", f.c_str());
+    printf(" %s\n", m_last_closed.c_str());
+    m_ring.clear();
+    m_state = IDLE;
+  }
+
+  TB_T *m_tb;
+  std::string m_prefix;
+  std::string m_ext;
+  int m_pre, m_post;
+  int m_state;
+  int m_frames_left;
+  std::string m_segment;        // File currently being dumped to, if any.
+  std::string m_last_closed;
+  std::deque<std::string> m_ring; // Closed pre-trigger files, oldest first.
+};
@@ -72,10 +72,15 @@ module map_rom #(
         assign val = dummy_memory[{col,row}][BITS-1:0];
     `else // not QUARTUS
         // $readmemh works OK with 2D array in everything else:
-        reg [7:0]   dummy_memory [0:MAXCOL][0:MAXROW];
+        reg [7:0]   dummy_memory [0:MAXCOL][0:MAXROW] /* verilator public */; // Public so the sim can check the tracer against it.
         // initial $error("NEED TO CHANGE REFERENCE BELOW TO USE MAP_FILE");
         // initial $readmemh("assets/map_64x64.hex", dummy_memory);
-        initial $readmemh(`MAP_FILE, dummy_memory);
+        // With ROM_IMAGE_PLUSARG (sim only), +rom_image means the sim fills dummy_memory itself:
+        initial
+    `ifdef ROM_IMAGE_PLUSARG
+        if (!$test$plusargs("rom_image"))
+    `endif
+            $readmemh(`MAP_FILE, dummy_memory);
         assign val = dummy_memory[col][row][BITS-1:0];
     `endif // QUARTUS
     
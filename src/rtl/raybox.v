@@ -146,10 +146,10 @@ module raybox(
 
     // assign speaker = 0; // Speaker is unused for now.
 
-    // Outputs from vga_sync:
-    wire [9:0]  h;          // Horizontal scan position (i.e. X pixel).
-    wire [9:0]  v;          // Vertical scan position (Y).
-    wire        visible;    // Are we in the visible region of the screen?
+    // Outputs from vga_sync (public so the sim can place each captured pixel directly):
+    wire [9:0]  h       /* verilator public */; // Horizontal scan position (i.e. X pixel).
+    wire [9:0]  v       /* verilator public */; // Vertical scan position (Y).
+    wire        visible /* verilator public */; // Are we in the visible region of the screen?
     wire [10:0] frame;      // Frame counter (0..2047); mostly unused.
     // `tick` pulses once, with the clock, at the start of a frame, to signal that animation can happen:
     
@@ -215,7 +215,7 @@ module raybox(
     //SMELL: Vectors get updated at pixel (0,479), i.e. last visible line, so that we get the "freshest"
     // value, but we make sure we've locked it in before the tracer needs it.
 
-    reg [143:0] ready_buffer; // Last buffered (complete) SPI bit stream that is ready for next loading as vector data.
+    reg [143:0] ready_buffer /* verilator public */; // Last buffered (complete) SPI bit stream that is ready for next loading as vector data.
     always @(posedge clk) begin
         if (!spi_load_ready) begin //SMELL: We shouldn't stop this logic during spi_load_ready, should we??
             if (spi_done) begin
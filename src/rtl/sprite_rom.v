@@ -39,7 +39,12 @@ module sprite_rom #(
     // I've just made it 8-bit for now to match my data file.
     reg [7:0] data [0:64*64-1] /* verilator public */;
 
-    initial begin
+    // With ROM_IMAGE_PLUSARG (sim only), +rom_image means the sim fills data itself:
+    initial
+`ifdef ROM_IMAGE_PLUSARG
+    if (!$test$plusargs("rom_image"))
+`endif
+    begin
         //NOTE: This file scans on Y axis first, then X.
         $readmemh(`SPRITE_FILE, data);
     end
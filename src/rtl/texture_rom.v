@@ -63,7 +63,12 @@ module texture_rom #(
         // I've just made it 8-bit for now to match my data file.
         reg [7:0] data [0:2][0:8191] /* verilator public */;
 
-        initial begin
+        // With ROM_IMAGE_PLUSARG (sim only), +rom_image means the sim fills data itself:
+        initial
+    `ifdef ROM_IMAGE_PLUSARG
+        if (!$test$plusargs("rom_image"))
+    `endif
+        begin
             //NOTE: This file scans on Y axis first, then X.
             $readmemh(`TEXTURE1_FILE, data,     0,   8191);
             $readmemh(`TEXTURE2_FILE, data,  8192,  16383);
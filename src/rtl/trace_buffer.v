@@ -45,10 +45,10 @@ module trace_buffer(
     reg             side_out;
     reg [5:0]       tex_out;
 
-    reg [15:0]      dummy_vdist_memory  [0:640-1];  // 10240 bits.
-    reg [1:0]       dummy_wtid_memory   [0:640-1];  // 1280 bits.
-    reg             dummy_side_memory   [0:640-1];  // 640 bits.
-    reg [5:0]       dummy_tex_memory    [0:640-1];  // 3840 bits.
+    reg [15:0]      dummy_vdist_memory  [0:640-1] /* verilator public */;  // 10240 bits.
+    reg [1:0]       dummy_wtid_memory   [0:640-1] /* verilator public */;  // 1280 bits.
+    reg             dummy_side_memory   [0:640-1] /* verilator public */;  // 640 bits.
+    reg [5:0]       dummy_tex_memory    [0:640-1] /* verilator public */;  // 3840 bits.
 
     // Tri-state buffer control for output mode:
     wire read_mode  = (cs && oe && !we);
@@ -82,9 +82,9 @@ module tracer #(
     localparam TEST     = 3;
     localparam DONE     = 4;  // For now, this has a 1 suffix because there are other repeats of this...
     
-    reg [2:0] state;
+    reg [2:0] state /* verilator public */;       // Public so the sim can profile the FSM.
     reg hit;
-    reg [9:0] col_counter;
+    reg [9:0] col_counter /* verilator public */;
 
 /* verilator lint_off REALCVT */
     localparam `F spriteX = `realF(32.5);
@@ -289,11 +289,13 @@ module tracer #(
                     // Check if we've hit a wall yet.
                     if (map_val!=0) begin
                         // Hit a wall.
+`ifndef QUIET_TRACER // Defined by the tracer-only bench build, which traces far too many frames to print each one.
                         if (col_counter == 639) begin
                             //NOTE: trace_cycle_count+2 to ensure DONE state will be covered:
                             $display("Frame %d finished tracing after %d clocks", debug_frame, trace_cycle_count+2);
                             $display("\t\t\t\t\t\t\t\t  spriteDist=%f t2=%f spriteCol=%d", `FrealS(spriteDist), `FrealS(t2), $signed(spriteCol));
                         end
+`endif // QUIET_TRACER
                         state <= DONE; // Finish the column; advance to next or stop.
                         store <= 1;
                     end else begin
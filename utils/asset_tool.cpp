@@ -16,130 +16,336 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 // #include <iostream>
-// #include <string>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 // using namespace std;
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 
+#include "../sim/rom_image.h"
+#include "../sim/png_rom.h"
 
-class RawImage {
-public:
-  uint8_t* m_raw;
-  int width;
-  int height;
-  bool valid;
-  RawImage() {
-    width = 0;
-    height = 0;
-    m_raw = NULL;
-    valid = false;
-  }
-  RawImage(const char* texture_file, int expect_width=0, int expect_height=0) : RawImage() {
-    load_image(texture_file, expect_width, expect_height);
-  }
-  ~RawImage() {
-    if (m_raw) delete m_raw;
-  }
-  void load_image(const char* f, int xw=0, int xh=0) {
-    SDL_Surface* s = IMG_Load(f);
-    if (!s) {
-      printf("ERROR: Failed to load texture image file '%s' due to error '%s'\n", f, SDL_GetError());
-      return;
-    }
-    width = s->w;
-    height = s->h;
-    if ( (xw && xw != width) || (xh && xh != height) ) {
-      printf("ERROR: Image '%s' should be %dx%d pixels, but is: %dx%d\n", f, xw, xh, width, height);
-      SDL_FreeSurface(s);
-      return;
-    }
-    Uint32 fmt = s->format->format;
-    if (fmt != SDL_PIXELFORMAT_RGB24) { //NOTE: 24-bit, not 32-bit (i.e. no alpha channel).
-      printf("ERROR: Image '%s' is wrong pixel format. Was expecting %x but got %x\n", f, SDL_PIXELFORMAT_RGB24, fmt);
-      SDL_FreeSurface(s);
-      return;
-    }
-    // Load raw image data...
-    SDL_LockSurface(s);
-    m_raw = new uint8_t[width*height*3];
-    for (int y = 0; y < height; ++y) {
-      // Copy line by line, because of s->pitch.
-      memcpy(m_raw + y*width*3, ((uint8_t*)(s->pixels)) + y*s->pitch, width*3 );
-    }
-    SDL_UnlockSurface(s);
-    // Done:
-    SDL_FreeSurface(s);
-    valid = true;
-  }
-  uint8_t* rgb(int x, int y) {
-    return m_raw+((y*width)+x)*3;
-  }
-  uint8_t r(int x, int y) { return rgb(x,y)[0]; }
-  uint8_t g(int x, int y) { return rgb(x,y)[1]; }
-  uint8_t b(int x, int y) { return rgb(x,y)[2]; }
-  // Returns 24-bit RGB value packed in a 32-bit uint: 0x00RRGGBB:
-  uint32_t xrgb(int x, int y) {
-    uint8_t* c = rgb(x, y);
-    return (c[0]<<16) | (c[1]<<8) | c[2];
-  }
-  // Return a packed RGB222 pixel value, i.e. 0b00rrggbb
-  uint8_t xrgb222(int x, int y) {
-    return (r(x,y)&0xC0)>>2 | (g(x,y)&0xC0)>>4 | (b(x,y)&0xC0)>>6;
+
+// Convert an image into the text of a hex ROM file (for $readmemh), in out:
+int convert_base(const char *source, int width, int height, bool is_map, std::string &out) {
+  std::vector<uint8_t> data;
+  if (!load_png_rom(source, width, height, is_map, data)) return 1;
+  rom_to_hex(data, out);
+  return 0;
+}
+
+// Write a whole file in one go:
+int write_file(const char *target, const std::string &data) {
+  FILE* f = fopen(target, "wb");
+  if (!f) {
+    printf("ERROR: Cannot write '%s'\n", target);
+    return 1;
   }
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  ok = (0 == fclose(f)) && ok;
+  if (!ok) printf("ERROR: Failed writing '%s'\n", target);
+  return ok ? 0 : 1;
+}
+
+typedef struct {
+  const char *kind;
+  int width, height;
+  bool is_map;
+} asset_kind_t;
+
+static const asset_kind_t kAssetKinds[] = {
+  { "sprite",  64, 64, false },
+  { "wall",   128, 64, false },
+  { "map",     64, 64, true  },
 };
 
-int convert_base(const char *source, const char *target, int width, int height, bool is_map) {
-  RawImage img;
-  img.load_image(source, width, height);
-  if (!img.valid) return 1;
-  FILE* f = fopen(target, "w");
-  // fprintf(f, "@00000000\n");
-  int counter = 0;
-  //NOTE: Output hex file runs by rows before columns:
-  for (int x=0; x<width; ++x) {
-    for (int y=0; y<height; ++y) {
-      int c = img.xrgb222(x,y);
-      if (is_map) {
-        switch (c) {
-          case 0b00000000:  c = 0b00; break;
-          case 0b00000011:  c = 0b01; break;
-          case 0b00110000:  c = 0b10; break;
-          case 0b00111111:  c = 0b11; break;
-          default:
-          {
-            printf("ERROR: Map uses invalid colour: %02X\n", c);
-            fclose(f);
-            return 1;
-          }
-        }
+const asset_kind_t *find_kind(const char *kind) {
+  for (auto &k : kAssetKinds) {
+    if (0 == strcmp(kind, k.kind)) return &k;
+  }
+  return NULL;
+}
+
+int convert(const asset_kind_t *kind, const char *source, const char *target) {
+  std::string out;
+  if (convert_base(source, kind->width, kind->height, kind->is_map, out)) return 1;
+  return write_file(target, out);
+}
+
+// Hex ROM files that make up a ROM image, in the order the rom command (and manifest) takes them:
+static const char *kRomInputs[] = { "texture1", "texture2", "texture3", "sprite", "map" };
+static const int kRomInputCount = sizeof(kRomInputs)/sizeof(*kRomInputs);
+static const asset_kind_t kRomKind = { "rom", 0, 0, false };
+
+// Pack hex ROM files (as loaded by $readmemh) into a binary ROM image (see sim/rom_image.h), in out:
+int pack_rom_base(const char *const inputs[kRomInputCount], std::string &out) {
+  std::vector<uint8_t> textures(ROM_TEXTURES*ROM_TEXTURE_SIZE);
+  std::vector<uint8_t> sprite(ROM_SPRITE_SIZE);
+  std::vector<uint8_t> map(ROM_MAP_SIZE);
+  for (int t = 0; t < ROM_TEXTURES; ++t) {
+    if (!read_hex_rom(inputs[t], &textures[t*ROM_TEXTURE_SIZE], ROM_TEXTURE_SIZE)) return 1;
+  }
+  if (!read_hex_rom(inputs[3], sprite.data(), sprite.size())) return 1;
+  if (!read_hex_rom(inputs[4], map.data(), map.size())) return 1;
+  ROM_IMAGE_BUILDER rom;
+  rom.add("texture", textures);
+  rom.add("sprite", sprite);
+  rom.add("map", map);
+  out = rom.build();
+  return 0;
+}
+
+int pack_rom(const char *target, const char *const inputs[kRomInputCount]) {
+  std::string out;
+  if (pack_rom_base(inputs, out)) return 1;
+  return write_file(target, out);
+}
+
+
+// Batch mode: Convert every asset listed in a manifest file, each line of which is:
+//    kind input.png output.hex
+// ...with kind being one of the commands (sprite, wall, map) and '#' starting a comment, or:
+//    rom output.rom texture1.hex texture2.hex texture3.hex sprite.hex map.hex
+// ...to pack hex ROM files (typically outputs of the other lines) into a binary ROM image.
+// Paths are as given, i.e. relative to wherever asset_tool is run from (normally the repo root).
+// Assets get converted in parallel. MANIFEST.cache remembers a hash of each input and output, so
+// an asset is skipped if its input is the same as last time and its output hasn't been touched.
+
+// 64-bit FNV-1a hash of a whole file. Returns false if the file can't be read:
+bool hash_file(const char *filename, uint64_t &hash) {
+  FILE *f = fopen(filename, "rb");
+  if (!f) return false;
+  hash = 0xCBF29CE484222325ull;
+  uint8_t buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    for (size_t i = 0; i < n; ++i) {
+      hash ^= buffer[i];
+      hash *= 0x100000001B3ull;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+uint64_t hash_string(const std::string &s) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  for (unsigned char c : s) {
+    hash ^= c;
+    hash *= 0x100000001B3ull;
+  }
+  return hash;
+}
+
+typedef struct {
+  const asset_kind_t *kind;
+  std::string input;
+  std::string output;
+  std::vector<std::string> rom_inputs; // kRomKind only, instead of input.
+  int line;
+  // Results:
+  uint64_t input_hash;
+  uint64_t output_hash;
+  enum { FAILED, CONVERTED, UP_TO_DATE } status;
+} batch_job_t;
+
+typedef struct {
+  uint64_t input_hash;
+  uint64_t output_hash;
+} cache_entry_t;
+
+// Cache lines are: kind input_hash output_hash output
+std::map<std::string, cache_entry_t> load_cache(const std::string &filename) {
+  std::map<std::string, cache_entry_t> cache;
+  FILE *f = fopen(filename.c_str(), "r");
+  if (!f) return cache;
+  char kind[32], output[1024];
+  unsigned long long in_hash, out_hash;
+  while (4 == fscanf(f, "%31s %llx %llx %1023s", kind, &in_hash, &out_hash, output)) {
+    cache[std::string(kind) + " " + output] = { in_hash, out_hash };
+  }
+  fclose(f);
+  return cache;
+}
+
+bool read_manifest(const char *manifest, std::vector<batch_job_t> &jobs) {
+  FILE *f = fopen(manifest, "r");
+  if (!f) {
+    printf("ERROR: Cannot open manifest '%s'\n", manifest);
+    return false;
+  }
+  char line[2048];
+  int line_number = 0;
+  bool ok = true;
+  while (fgets(line, sizeof(line), f)) {
+    ++line_number;
+    char *hash = strchr(line, '#');
+    if (hash) *hash = 0;
+    char kind[32], input[1024], output[1024];
+    int n = sscanf(line, "%31s %1023s %1023s", kind, input, output);
+    if (n <= 0) continue; // Blank line.
+    batch_job_t job = {};
+    if (0 == strcmp(kind, kRomKind.kind)) {
+      char rom_inputs[kRomInputCount][1024];
+      n = sscanf(line, "%*s %1023s %1023s %1023s %1023s %1023s %1023s", output,
+        rom_inputs[0], rom_inputs[1], rom_inputs[2], rom_inputs[3], rom_inputs[4]);
+      if (n != 1+kRomInputCount) {
+        printf("ERROR: %s line %d: Expected 'rom output.rom texture1.hex texture2.hex texture3.hex sprite.hex map.hex'\n", manifest, line_number);
+        ok = false;
+        continue;
+      }
+      job.kind = &kRomKind;
+      job.rom_inputs.assign(rom_inputs, rom_inputs + kRomInputCount);
+    } else {
+      const asset_kind_t *k = find_kind(kind);
+      if (n != 3 || !k) {
+        printf("ERROR: %s line %d: Expected 'sprite|wall|map input.png output.hex'\n", manifest, line_number);
+        ok = false;
+        continue;
       }
-      fprintf(f, "%02X%c", c, ((counter++ & 15) == 15) ? '\n' : ' ');
+      job.kind = k;
+      job.input = input;
     }
+    job.output = output;
+    job.line = line_number;
+    job.status = batch_job_t::FAILED;
+    jobs.push_back(job);
   }
   fclose(f);
-  return 0;
+  return ok;
+}
+
+// A ROM image's input hash covers all of its hex inputs:
+bool hash_rom_inputs(const batch_job_t &job, uint64_t &hash) {
+  std::string hashes;
+  for (auto &input : job.rom_inputs) {
+    uint64_t h;
+    if (!hash_file(input.c_str(), h)) {
+      printf("ERROR: Cannot read '%s'\n", input.c_str());
+      return false;
+    }
+    hashes.append((const char *)&h, sizeof(h));
+  }
+  hash = hash_string(hashes);
+  return true;
 }
 
+void run_job(batch_job_t &job, const std::map<std::string, cache_entry_t> &cache, bool force, std::mutex &print_lock) {
+  const char *msg = NULL;
+  bool is_rom = job.kind == &kRomKind;
+  if (is_rom) {
+    std::lock_guard<std::mutex> guard(print_lock);
+    if (!hash_rom_inputs(job, job.input_hash)) return;
+  } else if (!hash_file(job.input.c_str(), job.input_hash)) {
+    std::lock_guard<std::mutex> guard(print_lock);
+    printf("ERROR: Cannot read '%s'\n", job.input.c_str());
+    return;
+  }
+  auto cached = cache.find(std::string(job.kind->kind) + " " + job.output);
+  if (!force && cached != cache.end() && cached->second.input_hash == job.input_hash &&
+      hash_file(job.output.c_str(), job.output_hash) && cached->second.output_hash == job.output_hash) {
+    job.status = batch_job_t::UP_TO_DATE;
+    return;
+  }
+  std::string out;
+  int failed;
+  if (is_rom) {
+    const char *inputs[kRomInputCount];
+    for (int i = 0; i < kRomInputCount; ++i) inputs[i] = job.rom_inputs[i].c_str();
+    failed = pack_rom_base(inputs, out);
+  } else {
+    failed = convert_base(job.input.c_str(), job.kind->width, job.kind->height, job.kind->is_map, out);
+  }
+  if (failed || write_file(job.output.c_str(), out)) {
+    msg = "FAILED";
+  } else {
+    job.output_hash = hash_string(out);
+    job.status = batch_job_t::CONVERTED;
+    msg = "converted";
+  }
+  std::lock_guard<std::mutex> guard(print_lock);
+  printf("%-6s %s => %s: %s\n", job.kind->kind, is_rom ? "(hex ROMs)" : job.input.c_str(), job.output.c_str(), msg);
+}
 
-int convert_sprite  (const char *source, const char *target) { return convert_base(source, target,  64, 64, false); }
-int convert_wall    (const char *source, const char *target) { return convert_base(source, target, 128, 64, false); }
-int convert_map     (const char *source, const char *target) { return convert_base(source, target,  64, 64, true); }
+int batch(const char *manifest, int threads, bool force) {
+  std::vector<batch_job_t> jobs;
+  if (!read_manifest(manifest, jobs)) return 1;
+  std::string cache_file = std::string(manifest) + ".cache";
+  auto cache = load_cache(cache_file);
+
+  // Image conversions run in parallel. ROM images come after, as they're packed from their outputs:
+  std::vector<size_t> convert_jobs, rom_jobs;
+  for (size_t j = 0; j < jobs.size(); ++j) (jobs[j].kind == &kRomKind ? rom_jobs : convert_jobs).push_back(j);
+  std::atomic<size_t> next(0);
+  std::mutex print_lock;
+  std::vector<std::thread> workers;
+  threads = std::max(1, std::min<int>(threads, convert_jobs.size()));
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back([&]() {
+      size_t j;
+      while ((j = next++) < convert_jobs.size()) run_job(jobs[convert_jobs[j]], cache, force, print_lock);
+    });
+  }
+  for (auto &w : workers) w.join();
+  for (size_t j : rom_jobs) run_job(jobs[j], cache, force, print_lock);
+
+  // Rewrite the cache with everything that is now up to date (and drop everything else):
+  int converted = 0, up_to_date = 0, failed = 0;
+  std::string cache_text;
+  for (auto &job : jobs) {
+    switch (job.status) {
+      case batch_job_t::CONVERTED:  ++converted;  break;
+      case batch_job_t::UP_TO_DATE: ++up_to_date; break;
+      default:                      ++failed;     continue;
+    }
+    char line[2200];
+    snprintf(line, sizeof(line), "%s %016llx %016llx %s\n", job.kind->kind,
+      (unsigned long long)job.input_hash, (unsigned long long)job.output_hash, job.output.c_str());
+    cache_text += line;
+  }
+  if (write_file(cache_file.c_str(), cache_text)) return 1;
+  printf("%d asset(s): %d converted, %d up to date, %d failed\n", (int)jobs.size(), converted, up_to_date, failed);
+  return failed ? 1 : 0;
+}
 
 
 int main(int argc, char **argv) {
   bool bad_args;
-  char* cmd = argv[1];
+  const char* cmd = argc > 1 ? argv[1] : "";
   do {
     bad_args = true;
+    if (0 == strcmp(cmd, "batch")) {
+      // batch [-j THREADS] [-f] manifest
+      int threads = std::max(1u, std::thread::hardware_concurrency());
+      bool force = false;
+      const char *manifest = NULL;
+      for (int i = 2; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-j") && i+1 < argc) threads = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-f")) force = true;
+        else if (!manifest) manifest = argv[i];
+        else { manifest = NULL; break; }
+      }
+      if (!manifest) break;
+      return batch(manifest, threads, force);
+    }
+    if (0 == strcmp(cmd, "rom")) {
+      // rom output.rom texture1.hex texture2.hex texture3.hex sprite.hex map.hex
+      if (argc != 3+kRomInputCount) break;
+      return pack_rom(argv[2], argv+3);
+    }
     if (argc!=4) break;
-    if (0 == strcmp(cmd, "sprite")) {
-      return convert_sprite(argv[2], argv[3]);
-    } else if (0 == strcmp(cmd, "wall")) {
-      return convert_wall(argv[2], argv[3]);
-    } else if (0 == strcmp(cmd, "map")) {
-      return convert_map(argv[2], argv[3]);
+    const asset_kind_t *kind = find_kind(cmd);
+    if (kind) {
+      return convert(kind, argv[2], argv[3]);
     } else {
       printf("ERROR: Unknown command: '%s'\n", cmd);
       break;
@@ -151,8 +357,14 @@ int main(int argc, char **argv) {
       "where 'command' is one of:\n"
       "  sprite  = Convert single 64x64 sprite\n"
       "  wall    = Convert single 128x64 wall pair\n"
-      "  map     = Convert a 64x64 map\n",
-      *argv
+      "  map     = Convert a 64x64 map\n"
+      "or:    %s batch [-j THREADS] [-f] manifest\n"
+      "  Convert everything listed in the manifest (lines of: command input.png output.hex) in parallel,\n"
+      "  skipping any whose input and output haven't changed since last time (unless -f).\n"
+      "or:    %s rom output.rom texture1.hex texture2.hex texture3.hex sprite.hex map.hex\n"
+      "  Pack hex ROM files into a binary ROM image, for the sim's +rom_image option.\n",
+      *argv, *argv, *argv
     );
   }
+  return 1;
 }
@@ -0,0 +1,343 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Worst-case sweep of tracer cost over a map: Traces a grid of player positions (a number of
+// sub-positions within every empty map cell) and facing angles with sim/tracer_model.h, and
+// reports the most clocks the tracer FSM would need for a frame, the poses that need it, and
+// a heatmap of the worst case per map cell. This answers the VBLANK budget question posed at
+// the top of src/rtl/tracer.v for a whole map, rather than just wherever we've walked to in the sim.
+//
+// Map cells are split up between worker threads, each with its own TRACER_MODEL. Each worker
+// starts with a contiguous run of cells (i.e. a band of map rows), but costs vary a lot across
+// a map (open areas cost far more than corridors), so a worker that runs out steals cells
+// from the far end of another worker's queue.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "../sim/tracer_model.h"
+
+
+// Convert to raw Q12.12, the same way the sim's double2fixed() does:
+uint32_t q12_12_raw(double d) {
+  int32_t t = d * 4096.0;
+  return t & 0xFFFFFF;
+}
+
+double q12_12(uint32_t raw) {
+  return double(int32_t(raw << 8) >> 8) / 4096.0;
+}
+
+
+typedef struct {
+  int     threads;
+  int     angles;       // Facing angles per position, evenly spread over 360 degrees.
+  int     subdiv;       // Positions per cell are a subdiv x subdiv grid.
+  double  vplane;       // Viewplane length, relative to the (unit) facing vector. The F1..F9 poses use 0.5.
+  int     top;          // How many of the worst cells to list.
+  int     scale;        // Heatmap pixels per map cell.
+  const char *heatmap;
+  const char *map_file;
+} sweep_options_t;
+
+// Worst frame found at a given map cell:
+typedef struct {
+  int       cycles;     // Clocks the FSM needs for the whole frame (0 for a wall cell).
+  bool      escaped;    // Some ray went on forever (e.g. through a hole in the map's outer wall).
+  tracer_vectors_t v;
+} cell_result_t;
+
+
+// One queue of cells per worker. The owner takes cells from the front, and thieves take
+// them from the back, so they don't fight over the same part of the map:
+class WORK_QUEUES {
+public:
+  WORK_QUEUES(int workers) : m_queues(workers) { }
+
+  void push(int worker, int cell) { m_queues[worker].cells.push_back(cell); }
+
+  // Get the next cell for this worker, stealing one if its own queue is empty.
+  // Returns false when there's nothing left anywhere:
+  bool next(int worker, int &cell, unsigned long &steals) {
+    if (take(worker, cell, false)) return true;
+    int n = m_queues.size();
+    for (int i = 1; i < n; ++i) {
+      if (take((worker+i) % n, cell, true)) {
+        ++steals;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  typedef struct {
+    std::mutex lock;
+    std::deque<int> cells;
+  } queue_t;
+
+  bool take(int worker, int &cell, bool steal) {
+    queue_t &q = m_queues[worker];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.cells.empty()) return false;
+    if (steal) {
+      cell = q.cells.back();
+      q.cells.pop_back();
+    } else {
+      cell = q.cells.front();
+      q.cells.pop_front();
+    }
+    return true;
+  }
+
+  std::vector<queue_t> m_queues;
+};
+
+
+typedef struct {
+  unsigned long frames;
+  unsigned long over_budget;  // Frames that need more than the VBLANK budget.
+  unsigned long escaped;      // Frames with at least one ray that never hit a wall.
+  unsigned long steals;
+  unsigned long cells;
+} worker_stats_t;
+
+void sweep_worker(
+  int id, const sweep_options_t &opt, const TRACER_MODEL &map, WORK_QUEUES &queues,
+  std::vector<cell_result_t> &results, worker_stats_t &stats
+) {
+  TRACER_MODEL model = map; // Our own copy, so workers share nothing but the queues.
+  std::vector<tracer_column_t> columns(TRACER_MODEL::kColumns);
+  int size = 1 << model.map_size_bits();
+  int cell;
+  while (queues.next(id, cell, stats.steals)) {
+    int col = cell / size;
+    int row = cell % size;
+    cell_result_t &r = results[cell]; // Only ever written by whichever worker got this cell.
+    for (int sy = 0; sy < opt.subdiv; ++sy) {
+      for (int sx = 0; sx < opt.subdiv; ++sx) {
+        double px = col + (sx+0.5)/opt.subdiv;
+        double py = row + (sy+0.5)/opt.subdiv;
+        for (int a = 0; a < opt.angles; ++a) {
+          double angle = 2.0*M_PI*a/opt.angles;
+          double fx = cos(angle);
+          double fy = sin(angle);
+          // vplane is facing rotated 90 degrees clockwise (as in the sim's F1..F9 poses):
+          tracer_vectors_t v = {
+            q12_12_raw(px), q12_12_raw(py),
+            q12_12_raw(fx), q12_12_raw(fy),
+            q12_12_raw(-fy*opt.vplane), q12_12_raw(fx*opt.vplane)
+          };
+          int cycles = model.trace_frame(v, columns.data());
+          bool escaped = false;
+          for (int c = 0; c < TRACER_MODEL::kColumns && !escaped; ++c) escaped = !columns[c].hit;
+          ++stats.frames;
+          if (cycles > TRACER_MODEL::kVblankCycles) ++stats.over_budget;
+          if (escaped) ++stats.escaped;
+          r.escaped |= escaped;
+          if (cycles > r.cycles) {
+            r.cycles = cycles;
+            r.v = v;
+          }
+        }
+      }
+    }
+    ++stats.cells;
+  }
+}
+
+
+// Colour for a cost in [0,1]: Dark blue through cyan, green and yellow to red:
+void heat_colour(double t, uint8_t *rgb) {
+  static const uint8_t ramp[5][3] = { {0,0,128}, {0,192,255}, {0,224,0}, {255,224,0}, {255,0,0} };
+  t = std::min(1.0, std::max(0.0, t)) * 4.0;
+  int i = std::min(3, int(t));
+  double f = t - i;
+  for (int c = 0; c < 3; ++c) rgb[c] = ramp[i][c] + (ramp[i+1][c] - ramp[i][c]) * f;
+}
+
+// Write the worst cost of each map cell as a PPM image, with X (map col) across and Y (map row) down.
+// Walls are dark grey. The colour ramp runs from 0 up to the worst cell found, except that any cell
+// that goes over the VBLANK budget is magenta:
+bool write_heatmap(const sweep_options_t &opt, const TRACER_MODEL &map, const std::vector<cell_result_t> &results, int worst) {
+  FILE *f = fopen(opt.heatmap, "wb");
+  if (!f) {
+    printf("ERROR: Cannot write heatmap %s\n", opt.heatmap);
+    return false;
+  }
+  int size = 1 << map.map_size_bits();
+  int width = size * opt.scale;
+  fprintf(f, "P6\n%d %d\n255\n", width, width);
+  std::vector<uint8_t> line(width*3);
+  for (int row = 0; row < size; ++row) {
+    for (int col = 0; col < size; ++col) {
+      const cell_result_t &r = results[col*size + row];
+      uint8_t rgb[3];
+      if (map.map(col, row)) {
+        rgb[0] = rgb[1] = rgb[2] = 48;
+      } else if (r.cycles > TRACER_MODEL::kVblankCycles) {
+        rgb[0] = 255; rgb[1] = 0; rgb[2] = 255;
+      } else {
+        heat_colour(worst ? double(r.cycles)/worst : 0, rgb);
+      }
+      for (int x = 0; x < opt.scale; ++x) memcpy(&line[(col*opt.scale + x)*3], rgb, 3);
+    }
+    for (int y = 0; y < opt.scale; ++y) fwrite(line.data(), 1, line.size(), f);
+  }
+  fclose(f);
+  return true;
+}
+
+
+int sweep(const sweep_options_t &opt) {
+  TRACER_MODEL map;
+  if (!map.load_map_hex(opt.map_file)) return 1;
+  int size = 1 << map.map_size_bits();
+
+  // Hand out the empty cells in contiguous runs, one run per worker:
+  std::vector<int> cells;
+  for (int col = 0; col < size; ++col) {
+    for (int row = 0; row < size; ++row) {
+      if (!map.map(col, row)) cells.push_back(col*size + row);
+    }
+  }
+  WORK_QUEUES queues(opt.threads);
+  for (size_t i = 0; i < cells.size(); ++i) queues.push(i * opt.threads / cells.size(), cells[i]);
+
+  printf(
+    "Sweeping %s: %zu empty cell(s) x %d position(s) x %d angle(s) = %lu frame(s), on %d thread(s)\n",
+    opt.map_file, cells.size(), opt.subdiv*opt.subdiv, opt.angles,
+    (unsigned long)cells.size()*opt.subdiv*opt.subdiv*opt.angles, opt.threads
+  );
+
+  std::vector<cell_result_t> results(size*size, cell_result_t{});
+  std::vector<worker_stats_t> stats(opt.threads, worker_stats_t{});
+  std::vector<std::thread> workers;
+  auto start_time = std::chrono::steady_clock::now();
+  for (int i = 0; i < opt.threads; ++i) {
+    workers.emplace_back(sweep_worker, i, std::cref(opt), std::cref(map), std::ref(queues), std::ref(results), std::ref(stats[i]));
+  }
+  for (auto &w : workers) w.join();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+  worker_stats_t total = {};
+  for (int i = 0; i < opt.threads; ++i) {
+    printf("  Worker %2d: %5lu cell(s), %8lu frame(s), %4lu stolen\n", i, stats[i].cells, stats[i].frames, stats[i].steals);
+    total.frames      += stats[i].frames;
+    total.over_budget += stats[i].over_budget;
+    total.escaped     += stats[i].escaped;
+    total.steals      += stats[i].steals;
+  }
+  printf("Traced %lu frame(s) in %.3f s (%.0f frames/s)\n", total.frames, elapsed, elapsed > 0 ? total.frames/elapsed : 0);
+
+  // Rank the cells by their worst frame:
+  std::vector<int> ranked = cells;
+  std::sort(ranked.begin(), ranked.end(), [&](int a, int b) { return results[a].cycles > results[b].cycles; });
+  int worst = ranked.empty() ? 0 : results[ranked[0]].cycles;
+  printf(
+    "Worst case: %d clocks per frame (%.1f%% of the %d VBLANK budget)\n",
+    worst, 100.0*worst/TRACER_MODEL::kVblankCycles, TRACER_MODEL::kVblankCycles
+  );
+  if (total.over_budget) printf("WARNING: %lu frame(s) go over budget\n", total.over_budget);
+  if (total.escaped) printf("WARNING: %lu frame(s) have rays that never hit a wall (holes in the map?)\n", total.escaped);
+
+  printf("Worst %d cell(s), with their worst pose (as gTestVectors):\n", std::min<int>(opt.top, ranked.size()));
+  for (int i = 0; i < opt.top && i < (int)ranked.size(); ++i) {
+    const cell_result_t &r = results[ranked[i]];
+    const tracer_vectors_t &v = r.v;
+    printf(
+      "  %6d clocks at cell (%2d,%2d)%s: p=(%lf, %lf) f=(%lf, %lf) v=(%lf, %lf)\n",
+      r.cycles, ranked[i]/size, ranked[i]%size, r.escaped ? " (ESCAPED)" : "",
+      q12_12(v.px), q12_12(v.py), q12_12(v.fx), q12_12(v.fy), q12_12(v.vx), q12_12(v.vy)
+    );
+    printf("    { 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X, 0x%08X },\n", v.px, v.py, v.fx, v.fy, v.vx, v.vy);
+  }
+
+  if (opt.heatmap[0]) {
+    if (!write_heatmap(opt, map, results, worst)) return 1;
+    printf("Wrote heatmap to %s (%d pixel(s) per cell)\n", opt.heatmap, opt.scale);
+  }
+  printf(
+    "RESULT: frames=%lu worst=%d budget=%d over_budget=%lu escaped=%lu seconds=%.6f\n",
+    total.frames, worst, TRACER_MODEL::kVblankCycles, total.over_budget, total.escaped, elapsed
+  );
+  return total.over_budget ? 2 : 0;
+}
+
+
+int main(int argc, char **argv) {
+  sweep_options_t opt;
+  opt.threads   = std::max(1u, std::thread::hardware_concurrency());
+  opt.angles    = 128;
+  opt.subdiv    = 2;
+  opt.vplane    = 0.5;
+  opt.top       = 10;
+  opt.scale     = 8;
+  opt.heatmap   = "pose_sweep_heatmap.ppm";
+  opt.map_file  = NULL;
+
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *val = i+1 < argc ? argv[i+1] : NULL;
+    if (arg[0] != '-') {
+      opt.map_file = arg;
+      continue;
+    }
+    if (!val) {
+      opt.map_file = NULL;
+      break;
+    }
+    ++i;
+    if      (0 == strcmp(arg, "-j")) opt.threads  = atoi(val);
+    else if (0 == strcmp(arg, "-a")) opt.angles   = atoi(val);
+    else if (0 == strcmp(arg, "-s")) opt.subdiv   = atoi(val);
+    else if (0 == strcmp(arg, "-v")) opt.vplane   = atof(val);
+    else if (0 == strcmp(arg, "-n")) opt.top      = atoi(val);
+    else if (0 == strcmp(arg, "-x")) opt.scale    = atoi(val);
+    else if (0 == strcmp(arg, "-o")) opt.heatmap  = val;
+    else {
+      printf("ERROR: Unknown option: '%s'\n", arg);
+      opt.map_file = NULL;
+      break;
+    }
+  }
+  if (opt.map_file && opt.threads > 0 && opt.angles > 0 && opt.subdiv > 0 && opt.scale > 0) return sweep(opt);
+
+  printf(
+    "Usage: %s [options] map.hex\n"
+    "where 'options' are any of:\n"
+    "  -j THREADS   = Worker threads (default: all cores)\n"
+    "  -a ANGLES    = Facing angles per position (default 128)\n"
+    "  -s SUBDIV    = SUBDIV x SUBDIV positions per empty map cell (default 2)\n"
+    "  -v VPLANE    = Viewplane length, i.e. FOV (default 0.5)\n"
+    "  -n TOP       = How many of the worst cells to list (default 10)\n"
+    "  -o FILE.ppm  = Heatmap of the worst case per map cell (default pose_sweep_heatmap.ppm; '' for none)\n"
+    "  -x SCALE     = Heatmap pixels per map cell (default 8)\n"
+    "Exits with 2 if any frame would go over the VBLANK budget.\n",
+    *argv
+  );
+  return 1;
+}
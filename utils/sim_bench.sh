@@ -0,0 +1,107 @@
+#!/usr/bin/env bash
+# SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+# SPDX-License-Identifier: Apache-2.0
+#
+# Builds each variant of the sim, runs the same fixed headless workloads on each, and reports
+# simulated clock speed, frames/s and peak RSS as a table (also written to OUT as CSV), compared
+# against a baseline from an earlier run. Usually run via: make bench (or make bench_baseline)
+#
+# Variants:
+#   default      sim/obj_dir (the normal build)
+#   trace        sim/obj_dir_fst (TRACE_FST build, savable like the default), dumping every tick:
+#                Waveform capture stays armed with a 1-frame pre-trigger ring (+wave_pre=1), in a
+#                temp dir that gets removed after.
+#   rand0..2     The default build, run with +verilator+rand+reset+0, 1 and 2 (fixed seed)
+#
+# Workloads:
+#   static       gTestVectors pose F1, held still for FRAMES frames.
+#   motion       Replay of utils/bench/motion.log (new vectors every frame).
+#   map          Replay of utils/bench/map_overlay.log (pose F1, with show_map on).
+#
+# Usage: utils/sim_bench.sh [--save-baseline]
+#   --save-baseline  Also copy this run's results to BASELINE, for later runs to compare against.
+#
+# Environment overrides:
+#   VARIANTS   Variants to run (default: all of the above).
+#   WORKLOADS  Workloads to run (default "static motion map").
+#   FRAMES     Frames for the static workload (default 60; the replays run for as long as their logs).
+#   OUT        CSV results file (default bench_results.csv).
+#   BASELINE   CSV baseline file (default bench_baseline.csv).
+#   TOLERANCE  Hz difference from the baseline (in %) beyond which a result is flagged (default 5).
+
+set -e
+cd "$(dirname "$0")/.."
+
+VARIANTS=${VARIANTS:-"default trace rand0 rand1 rand2"}
+WORKLOADS=${WORKLOADS:-"static motion map"}
+FRAMES=${FRAMES:-60}
+OUT=${OUT:-bench_results.csv}
+BASELINE=${BASELINE:-bench_baseline.csv}
+TOLERANCE=${TOLERANCE:-5}
+SEED=22860
+EXE=Vraybox
+[ "$OS" == "Windows_NT" ] && EXE=Vraybox.exe
+
+save_baseline=
+WAVE_DIR=$(mktemp -d)
+trap 'rm -rf "$WAVE_DIR"' EXIT
+[ "$1" == "--save-baseline" ] && save_baseline=1
+
+# Executable for a variant, and any plusargs it adds:
+variant_exe() {
+  case $1 in
+    trace)        echo "sim/obj_dir_fst/$EXE" ;;
+    default|rand*) echo "sim/obj_dir/$EXE" ;;
+    *) echo "ERROR: Unknown variant: $1" >&2; exit 1 ;;
+  esac
+}
+variant_args() {
+  case $1 in
+    trace) echo "+wave=$WAVE_DIR/bench +wave_pre=1" ;;
+    rand0) echo "+verilator+rand+reset+0" ;;
+    rand1) echo "+verilator+rand+reset+1" ;;
+    rand2) echo "+verilator+rand+reset+2 +verilator+seed+$SEED" ;;
+  esac
+}
+workload_args() {
+  case $1 in
+    static) echo "+frames=$FRAMES +pose=1" ;;
+    motion) echo "+replay=utils/bench/motion.log" ;;
+    map)    echo "+replay=utils/bench/map_overlay.log" ;;
+    *) echo "ERROR: Unknown workload: $1" >&2; exit 1 ;;
+  esac
+}
+
+echo "Sim bench: $WORKLOADS on $VARIANTS, on a host with $(nproc 2>/dev/null || echo '?') CPU(s)"
+for v in $VARIANTS; do
+  make -s "$(variant_exe $v)" >/dev/null
+done
+
+echo "variant,workload,frames,ticks,seconds,hz,fps,peak_rss_kb" > "$OUT"
+printf "%-13s %-8s %7s %14s %9s %12s %9s\n" variant workload frames hz fps peak_rss_kb vs_base
+for v in $VARIANTS; do
+  for w in $WORKLOADS; do
+    result=$("$(variant_exe $v)" +headless +no_dump $(variant_args $v) $(workload_args $w) | grep '^RESULT:')
+    field() { sed -E "s/.* $1=([0-9.]+).*/\1/" <<< "$result"; }
+    frames=$(field frames); ticks=$(field ticks); seconds=$(field seconds); hz=$(field hz); rss=$(field peak_rss_kb)
+    fps=$(awk -v f="$frames" -v s="$seconds" 'BEGIN { printf "%.2f", (s>0 ? f/s : 0) }')
+    echo "$v,$w,$frames,$ticks,$seconds,$hz,$fps,$rss" >> "$OUT"
+    # Compare Hz with the same variant and workload in the baseline, if it has them:
+    base_hz=
+    [ -f "$BASELINE" ] && base_hz=$(awk -F, -v v="$v" -v w="$w" '$1==v && $2==w { print $6 }' "$BASELINE")
+    vs=$(awk -v hz="$hz" -v b="$base_hz" -v t="$TOLERANCE" 'BEGIN {
+      if (b == "" || b <= 0) { print "-"; exit }
+      d = 100.0*(hz-b)/b
+      printf "%+.1f%%%s", d, (d < -t ? " SLOWER" : (d > t ? " FASTER" : ""))
+    }')
+    printf "%-13s %-8s %7d %14d %9.2f %12d %9s\n" $v $w $frames $hz $fps $rss "$vs"
+  done
+done
+echo "Results written to $OUT"
+
+if [ -n "$save_baseline" ]; then
+  cp "$OUT" "$BASELINE"
+  echo "Saved as the baseline in $BASELINE"
+elif [ ! -f "$BASELINE" ]; then
+  echo "No baseline to compare with yet; make one with: make bench_baseline"
+fi
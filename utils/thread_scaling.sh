@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+# SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+# SPDX-License-Identifier: Apache-2.0
+#
+# Builds the sim with Verilator's multithreaded model at each of THREADS, runs the
+# same fixed-pose headless workload on each build, and reports simulated clock speed
+# against the sim's target CLOCK_HZ. Usually run via: make bench_threads
+#
+# Environment overrides:
+#   THREADS   Thread counts to try (default "1 2 4 8").
+#   FRAMES    Frames to simulate per run (default 30).
+#   POSE      gTestVectors pose to start from, 1..10 (default 1).
+
+set -e
+cd "$(dirname "$0")/.."
+
+THREADS=${THREADS:-"1 2 4 8"}
+FRAMES=${FRAMES:-30}
+POSE=${POSE:-1}
+EXE=Vraybox
+[ "$OS" == "Windows_NT" ] && EXE=Vraybox.exe
+
+echo "Thread scaling: $FRAMES frame(s) from pose F$POSE on a host with $(nproc 2>/dev/null || echo '?') CPU(s)"
+for n in $THREADS; do
+  make -s "sim/obj_dir_mt$n/$EXE" >/dev/null
+done
+
+printf "%8s %14s %14s %9s %9s\n" threads hz target_hz target% speedup
+base_hz=
+for n in $THREADS; do
+  result=$("sim/obj_dir_mt$n/$EXE" +headless +frames=$FRAMES +pose=$POSE +no_dump | grep '^RESULT:')
+  hz=$(sed -E 's/.* hz=([0-9]+).*/\1/' <<< "$result")
+  target=$(sed -E 's/.* target_hz=([0-9]+).*/\1/' <<< "$result")
+  [ -z "$base_hz" ] && base_hz=$hz
+  awk -v n="$n" -v hz="$hz" -v t="$target" -v b="$base_hz" \
+    'BEGIN { printf "%8d %14d %14d %8.1f%% %8.2fx\n", n, hz, t, 100.0*hz/t, (b>0 ? hz/b : 0) }'
+done
@@ -0,0 +1,169 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Anton Maurovic <anton@maurovic.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Tool for trace capture files (see sim/trace_capture.h), e.g. as written by the sim's +capture option.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+
+#include "../sim/trace_capture.h"
+
+
+double q12_12(uint32_t raw) {
+  return double(int32_t(raw << 8) >> 8) / 4096.0;
+}
+
+
+// Legacy captures (e.g. assets/traces_capture_0000.hex) are byte-wise hex dumps of an older
+// trace_buffer that held {7'b0, side, wall_height[7:0]} per column, little-endian, so 1280 bytes.
+// wall_height is the half-height of the wall in pixels (i.e. 256/vdist, clamped at 240), so the
+// nearest vdist can be worked back from it, but tex and wtid weren't stored, and neither were vectors.
+bool read_legacy_hex(const char *filename, trace_record_t &record) {
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    printf("ERROR: Cannot open %s\n", filename);
+    return false;
+  }
+  std::vector<uint8_t> bytes(TRACE_CAPTURE_COLUMNS*2, 0);
+  size_t addr = 0;
+  size_t count = 0;
+  char token[64];
+  while (fscanf(f, "%63s", token) == 1) {
+    if (token[0] == '@') {
+      addr = strtoul(token+1, NULL, 16);
+    }
+    else if (isxdigit(token[0])) {
+      if (addr < bytes.size()) {
+        bytes[addr] = strtoul(token, NULL, 16);
+        ++count;
+      }
+      ++addr;
+    }
+  }
+  fclose(f);
+  if (count != bytes.size()) {
+    printf("WARNING: %s has %zu bytes; expected %zu\n", filename, count, bytes.size());
+  }
+  memset(&record, 0, sizeof(record));
+  record.flags = TRACE_RECORD_LEGACY;
+  for (int col = 0; col < TRACE_CAPTURE_COLUMNS; ++col) {
+    int height = bytes[col*2];
+    int side = bytes[col*2+1] & 1;
+    // vdist is UQ7.9, so vdist = 256/height becomes (256<<9)/height:
+    uint32_t vdist = height ? ((256<<9) + height/2) / height : 0xFFFF;
+    if (vdist > 0xFFFF) vdist = 0xFFFF;
+    record.columns[col] = trace_pack(vdist, 0, 0, side);
+  }
+  return true;
+}
+
+// Frame number for a legacy capture, from the digits at the end of its name (e.g. traces_capture_0003.hex):
+int legacy_frame_number(const char *filename, int fallback) {
+  std::string name = filename;
+  size_t dot = name.find_last_of('.');
+  if (dot == std::string::npos) dot = name.length();
+  size_t start = dot;
+  while (start > 0 && isdigit(name[start-1])) --start;
+  return start < dot ? atoi(name.substr(start, dot-start).c_str()) : fallback;
+}
+
+int convert_legacy(const char *outfile, int count, char **infiles) {
+  TRACE_CAPTURE_WRITER out;
+  if (!out.open(outfile)) return 1;
+  trace_record_t record;
+  for (int i = 0; i < count; ++i) {
+    if (!read_legacy_hex(infiles[i], record)) return 1;
+    record.frame = legacy_frame_number(infiles[i], i);
+    if (!out.write(record)) return 1;
+    printf("%s => frame %u\n", infiles[i], record.frame);
+  }
+  printf("Appended %lu record(s) to %s\n", out.records(), outfile);
+  return 0;
+}
+
+
+int info(const char *infile) {
+  TRACE_CAPTURE_READER in;
+  if (!in.open(infile)) return 1;
+  trace_record_t r;
+  unsigned long n = 0;
+  while (in.next(r)) {
+    uint16_t lo = 0xFFFF, hi = 0;
+    for (int col = 0; col < TRACE_CAPTURE_COLUMNS; ++col) {
+      uint16_t d = trace_vdist(r.columns[col]);
+      if (d < lo) lo = d;
+      if (d > hi) hi = d;
+    }
+    printf("frame %6u%s", r.frame, (r.flags & TRACE_RECORD_LEGACY) ? " (legacy)" : "");
+    if (!(r.flags & TRACE_RECORD_LEGACY)) {
+      printf(
+        "  p=(%lf, %lf) f=(%lf, %lf) v=(%lf, %lf)",
+        q12_12(r.vectors[0]), q12_12(r.vectors[1]), q12_12(r.vectors[2]),
+        q12_12(r.vectors[3]), q12_12(r.vectors[4]), q12_12(r.vectors[5])
+      );
+    }
+    printf("  vdist=[%lf, %lf]\n", lo/512.0, hi/512.0);
+    ++n;
+  }
+  printf("%lu record(s)\n", n);
+  return 0;
+}
+
+
+int dump(const char *infile, unsigned frame) {
+  TRACE_CAPTURE_READER in;
+  if (!in.open(infile)) return 1;
+  trace_record_t r;
+  while (in.next(r)) {
+    if (r.frame != frame) continue;
+    printf("// Frame %u; column: vdist side wtid tex\n", r.frame);
+    for (int col = 0; col < TRACE_CAPTURE_COLUMNS; ++col) {
+      uint32_t c = r.columns[col];
+      printf("%3d: %04X %d %d %2d\n", col, trace_vdist(c), trace_side(c), trace_wtid(c), trace_tex(c));
+    }
+    return 0;
+  }
+  printf("ERROR: Frame %u not found in %s\n", frame, infile);
+  return 1;
+}
+
+
+int main(int argc, char **argv) {
+  const char *cmd = argc > 1 ? argv[1] : "";
+  if (0 == strcmp(cmd, "convert") && argc >= 4) {
+    return convert_legacy(argv[2], argc-3, argv+3);
+  } else if (0 == strcmp(cmd, "info") && argc == 3) {
+    return info(argv[2]);
+  } else if (0 == strcmp(cmd, "dump") && argc == 4) {
+    return dump(argv[2], strtoul(argv[3], NULL, 10));
+  } else if (cmd[0]) {
+    printf("ERROR: Unknown command or wrong arguments: '%s'\n", cmd);
+  }
+  printf(
+    "Usage: %s command ...\n"
+    "where 'command' is one of:\n"
+    "  convert capture.bin legacy.hex...  = Append legacy .hex captures to a capture file\n"
+    "  info capture.bin                   = Summarise each frame in a capture file\n"
+    "  dump capture.bin FRAME             = Print all columns of one frame\n",
+    *argv
+  );
+  return 1;
+}